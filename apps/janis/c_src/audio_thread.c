@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sched.h>
+#include <sys/syscall.h>
+
+#include "audio_thread.h"
+#include "pa_memorybarrier.h"
+
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE (6)
+#endif
+
+// glibc doesn't wrap sched_setattr
+struct audio_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t  sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+};
+
+static const char *policy_names[] = {
+	[AUDIO_SCHED_OTHER]    = "other",
+	[AUDIO_SCHED_FIFO]     = "fifo",
+	[AUDIO_SCHED_RR]       = "rr",
+	[AUDIO_SCHED_DEADLINE] = "deadline"
+};
+
+void audio_thread_options_init(audio_thread_options_t *options) {
+	options->cpu        = AUDIO_CPU_LAST;
+	options->policy     = AUDIO_SCHED_FIFO;
+	options->priority   = 0;
+	options->runtime_us = 1000;
+	options->period_us  = 5000;
+	options->isolate    = false;
+}
+
+void audio_thread_init(audio_thread_t *audio_thread) {
+	memset(audio_thread, 0, sizeof(audio_thread_t));
+	audio_thread->cpu = AUDIO_CPU_NONE;
+}
+
+void audio_thread_capture(audio_thread_t *audio_thread) {
+	if (audio_thread->captured) { return; }
+
+	audio_thread->thread = pthread_self();
+#ifdef SYS_gettid
+	audio_thread->tid    = (pid_t)syscall(SYS_gettid);
+#endif
+	PaUtil_WriteMemoryBarrier();
+	audio_thread->captured = true;
+}
+
+bool audio_thread_pending(audio_thread_t *audio_thread) {
+	if (!audio_thread->captured || audio_thread->configured) { return false; }
+	PaUtil_ReadMemoryBarrier();
+	return true;
+}
+
+const char *audio_thread_policy_name(audio_sched_policy_t policy) {
+	return policy_names[policy];
+}
+
+bool audio_thread_policy_parse(const char *name, audio_sched_policy_t *policy) {
+	for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+		if (strcmp(name, policy_names[i]) == 0) {
+			*policy = (audio_sched_policy_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Not worth making this work on os x..
+#ifndef __APPLE__
+
+static int set_affinity(audio_thread_t *audio_thread, int cpu) {
+	cpu_set_t cpus;
+
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+
+	return pthread_setaffinity_np(audio_thread->thread, sizeof(cpu_set_t), &cpus);
+}
+
+static int set_deadline(audio_thread_t *audio_thread, const audio_thread_options_t *options) {
+#ifdef SYS_sched_setattr
+	struct audio_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size           = sizeof(attr);
+	attr.sched_policy   = SCHED_DEADLINE;
+	attr.sched_runtime  = (uint64_t)options->runtime_us * 1000;
+	attr.sched_deadline = (uint64_t)options->period_us * 1000;
+	attr.sched_period   = (uint64_t)options->period_us * 1000;
+
+	if (syscall(SYS_sched_setattr, audio_thread->tid, &attr, 0) != 0) {
+		return errno;
+	}
+	return 0;
+#else
+	(void)audio_thread;
+	(void)options;
+	return ENOSYS;
+#endif
+}
+
+static int set_scheduling(audio_thread_t *audio_thread, const audio_thread_options_t *options) {
+	struct sched_param sched_param;
+	int policy;
+
+	switch (options->policy) {
+		case AUDIO_SCHED_DEADLINE:
+			audio_thread->priority = 0;
+			return set_deadline(audio_thread, options);
+		case AUDIO_SCHED_FIFO:
+			policy = SCHED_FIFO;
+			break;
+		case AUDIO_SCHED_RR:
+			policy = SCHED_RR;
+			break;
+		default:
+			policy = SCHED_OTHER;
+	}
+
+	sched_param.sched_priority = options->priority;
+
+	if (policy == SCHED_OTHER) {
+		sched_param.sched_priority = 0;
+	} else if (options->priority == 0) {
+		sched_param.sched_priority = sched_get_priority_max(policy);
+	}
+	audio_thread->priority = sched_param.sched_priority;
+
+	return pthread_setschedparam(audio_thread->thread, policy, &sched_param);
+}
+
+// takes `cpu` out of the affinity of every other thread in the process,
+// returning the number of threads moved
+static int isolate_cpu(audio_thread_t *audio_thread, int cpu) {
+	DIR *dir = opendir("/proc/self/task");
+	struct dirent *entry;
+	int moved = 0;
+
+	if (dir == NULL) { return 0; }
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.') { continue; }
+
+		pid_t tid = (pid_t)atoi(entry->d_name);
+		cpu_set_t cpus;
+
+		if (tid == audio_thread->tid) { continue; }
+		if (sched_getaffinity(tid, sizeof(cpu_set_t), &cpus) != 0) { continue; }
+		if (!CPU_ISSET(cpu, &cpus)) { continue; }
+
+		CPU_CLR(cpu, &cpus);
+
+		// never leave a thread with nowhere to run
+		if (CPU_COUNT(&cpus) == 0) { continue; }
+
+		if (sched_setaffinity(tid, sizeof(cpu_set_t), &cpus) == 0) {
+			moved++;
+		}
+	}
+	closedir(dir);
+	return moved;
+}
+
+void audio_thread_configure(audio_thread_t *audio_thread, const audio_thread_options_t *options) {
+	int processor_count = sysconf(_SC_NPROCESSORS_ONLN);
+	int cpu = options->cpu;
+
+	audio_thread->configured = true;
+
+	if (cpu == AUDIO_CPU_LAST) {
+		cpu = processor_count - 1;
+	}
+
+	// SCHED_DEADLINE threads have to be free to run on every cpu in their
+	// root domain, so pinning one gets EBUSY
+	if (options->policy == AUDIO_SCHED_DEADLINE) {
+		cpu = AUDIO_CPU_NONE;
+	}
+
+	if (cpu >= processor_count) {
+		audio_thread->affinity_error = EINVAL;
+	} else if (cpu >= 0) {
+		audio_thread->affinity_error = set_affinity(audio_thread, cpu);
+	}
+	audio_thread->cpu = (cpu >= 0 && audio_thread->affinity_error == 0) ? cpu : AUDIO_CPU_NONE;
+
+	audio_thread->sched_error = set_scheduling(audio_thread, options);
+
+	if (options->isolate && audio_thread->cpu >= 0) {
+		audio_thread->isolated_threads = isolate_cpu(audio_thread, audio_thread->cpu);
+	}
+
+	char cpu_name[16] = "none";
+
+	if (audio_thread->cpu >= 0) {
+		snprintf(cpu_name, sizeof(cpu_name), "%d", audio_thread->cpu);
+	}
+
+	printf("=== Audio thread %d: cpu %s/%d (%s) %s %d (%s), moved %d other threads\r\n",
+			(int)audio_thread->tid,
+			cpu_name,
+			processor_count,
+			audio_thread->affinity_error ? strerror(audio_thread->affinity_error) : "ok",
+			audio_thread_policy_name(options->policy),
+			audio_thread->priority,
+			audio_thread->sched_error ? strerror(audio_thread->sched_error) : "ok",
+			audio_thread->isolated_threads);
+
+	PaUtil_WriteMemoryBarrier();
+	audio_thread->reported = true;
+}
+
+#else
+
+void audio_thread_configure(audio_thread_t *audio_thread, const audio_thread_options_t *options) {
+	(void)options;
+	audio_thread->configured = true;
+	audio_thread->reported   = true;
+}
+
+#endif // __APPLE__
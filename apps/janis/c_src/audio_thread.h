@@ -0,0 +1,64 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// PortAudio creates the audio thread so the first we know of it is when the
+// callback runs. Rather than making blocking syscalls from the callback it
+// just records who it is & the housekeeping thread sets the affinity &
+// scheduling on its behalf.
+
+// audio_thread_options_t.cpu
+#define AUDIO_CPU_LAST (-1)
+#define AUDIO_CPU_NONE (-2)
+
+typedef enum {
+	AUDIO_SCHED_OTHER = 0,
+	AUDIO_SCHED_FIFO,
+	AUDIO_SCHED_RR,
+	AUDIO_SCHED_DEADLINE
+} audio_sched_policy_t;
+
+typedef struct {
+	// the core to pin the thread to, AUDIO_CPU_LAST or AUDIO_CPU_NONE
+	int                  cpu;
+	audio_sched_policy_t policy;
+	// for fifo & rr, 0 uses the policy's maximum
+	int                  priority;
+	// for deadline, the deadline is the same as the period
+	uint32_t             runtime_us;
+	uint32_t             period_us;
+	// move the process's other threads, e.g. the BEAM's schedulers, off
+	// the audio thread's core
+	bool                 isolate;
+} audio_thread_options_t;
+
+typedef struct {
+	pthread_t     thread;
+	pid_t         tid;
+	volatile bool captured;
+	bool          configured;
+
+	// what audio_thread_configure managed, errno values (0 is success).
+	// Only valid once `reported` is set.
+	int           cpu;
+	int           priority;
+	int           affinity_error;
+	int           sched_error;
+	int           isolated_threads;
+	volatile bool reported;
+} audio_thread_t;
+
+void audio_thread_options_init(audio_thread_options_t *options);
+
+void audio_thread_init(audio_thread_t *audio_thread);
+
+// called from the audio callback, cheap after the first call
+void audio_thread_capture(audio_thread_t *audio_thread);
+
+// called from the housekeeping thread
+bool audio_thread_pending(audio_thread_t *audio_thread);
+void audio_thread_configure(audio_thread_t *audio_thread, const audio_thread_options_t *options);
+
+const char *audio_thread_policy_name(audio_sched_policy_t policy);
+bool        audio_thread_policy_parse(const char *name, audio_sched_policy_t *policy);
@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <erl_driver.h>
+
+// The driver API is exported by the emulator rather than a library, so the
+// standalone tools need their own versions of the bits the driver uses.
+
+void *driver_alloc(ErlDrvSizeT size) {
+	return malloc(size);
+}
+
+void *driver_realloc(void *ptr, ErlDrvSizeT size) {
+	return realloc(ptr, size);
+}
+
+void driver_free(void *ptr) {
+	free(ptr);
+}
+
+int erl_drv_thread_create(char *name, ErlDrvTid *tid, void * (*func)(void *), void *args, ErlDrvThreadOpts *opts) {
+	pthread_t *thread = malloc(sizeof(pthread_t));
+
+	(void)name;
+	(void)opts;
+
+	if (pthread_create(thread, NULL, func, args) != 0) {
+		free(thread);
+		return -1;
+	}
+	*tid = (ErlDrvTid)thread;
+	return 0;
+}
+
+int erl_drv_thread_join(ErlDrvTid tid, void **respp) {
+	pthread_t *thread = (pthread_t*)tid;
+	int err = pthread_join(*thread, respp);
+	free(thread);
+	return err;
+}
+
+char *erl_errno_id(int error) {
+	(void)error;
+	return "error";
+}
+
+// there's no one to send messages to
+ErlDrvTermData driver_mk_port(ErlDrvPort port) {
+	(void)port;
+	return 0;
+}
+
+ErlDrvTermData driver_mk_atom(char *string) {
+	(void)string;
+	return 0;
+}
+
+int erl_drv_output_term(ErlDrvTermData port, ErlDrvTermData *data, int len) {
+	(void)port;
+	(void)data;
+	(void)len;
+	return 0;
+}
+
+// the tools never open the time sync socket
+int driver_select(ErlDrvPort port, ErlDrvEvent event, int mode, int on) {
+	(void)port;
+	(void)event;
+	(void)mode;
+	(void)on;
+	return 0;
+}
+
+ErlDrvMutex *erl_drv_mutex_create(char *name) {
+	pthread_mutex_t *mutex = malloc(sizeof(pthread_mutex_t));
+
+	(void)name;
+
+	pthread_mutex_init(mutex, NULL);
+	return (ErlDrvMutex*)mutex;
+}
+
+void erl_drv_mutex_destroy(ErlDrvMutex *mtx) {
+	pthread_mutex_destroy((pthread_mutex_t*)mtx);
+	free(mtx);
+}
+
+void erl_drv_mutex_lock(ErlDrvMutex *mtx) {
+	pthread_mutex_lock((pthread_mutex_t*)mtx);
+}
+
+void erl_drv_mutex_unlock(ErlDrvMutex *mtx) {
+	pthread_mutex_unlock((pthread_mutex_t*)mtx);
+}
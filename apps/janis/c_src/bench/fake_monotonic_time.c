@@ -0,0 +1,38 @@
+#include <math.h>
+
+#include "../monotonic_time.h"
+#include "fake_monotonic_time.h"
+
+// the driver's threads read it while the tool's thread sets it
+static volatile uint64_t now_ns;
+
+void fake_monotonic_set(uint64_t ns) {
+	now_ns = ns;
+}
+
+uint64_t fake_monotonic_get(void) {
+	return now_ns;
+}
+
+uint64_t monotonic_nanoseconds(void) {
+	return now_ns;
+}
+
+uint64_t monotonic_microseconds(void) {
+	return now_ns / 1000;
+}
+
+uint64_t monotonic_milliseconds(void) {
+	return now_ns / 1000000;
+}
+
+// the virtual clock doesn't move between readings so one is as good as any
+void monotonic_pair(clock_pair_t *pair, clock_read_t read, void *arg) {
+	pair->monotonic_ns = now_ns;
+	pair->time         = read(arg);
+}
+
+uint64_t monotonic_pair_to_microseconds(const clock_pair_t *pair, double time) {
+	int64_t delta_ns = (int64_t)llround((time - pair->time) * 1e9);
+	return (uint64_t)((int64_t)pair->monotonic_ns + delta_ns) / (uint64_t)1000;
+}
@@ -0,0 +1,14 @@
+#ifndef __FAKE_MONOTONIC_TIME__
+#define __FAKE_MONOTONIC_TIME__ 1
+
+#include <stdint.h>
+
+// A monotonic clock that only moves when the tool says so, linked in place
+// of monotonic_time.c so that everything the driver times (the sync loop,
+// packet deadlines, the clock mapping) runs on the tool's virtual time & a
+// run comes out the same every time.
+
+void     fake_monotonic_set(uint64_t ns);
+uint64_t fake_monotonic_get(void);
+
+#endif
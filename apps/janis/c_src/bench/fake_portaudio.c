@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "fake_portaudio.h"
+
+#ifdef __linux__
+#include <pa_linux_alsa.h>
+#endif
+
+static fake_stream_t stream;
+
+static const PaDeviceInfo device_info = {
+	.structVersion            = 2,
+	.name                     = "fake",
+	.hostApi                  = 0,
+	.maxInputChannels         = 0,
+	.maxOutputChannels        = 2,
+	.defaultLowInputLatency   = FAKE_DEVICE_LATENCY,
+	.defaultLowOutputLatency  = FAKE_DEVICE_LATENCY,
+	.defaultHighInputLatency  = FAKE_DEVICE_LATENCY,
+	.defaultHighOutputLatency = FAKE_DEVICE_LATENCY,
+	.defaultSampleRate        = 44100.0
+};
+
+fake_stream_t *fake_portaudio_stream(void) {
+	return &stream;
+}
+
+int fake_portaudio_pump(
+		fake_stream_t                   *s,
+		void                            *output,
+		unsigned long                    frame_count,
+		const PaStreamCallbackTimeInfo  *time_info)
+{
+	s->stream_time = time_info->currentTime;
+	return s->callback(NULL, output, frame_count, time_info, 0, s->user_data);
+}
+
+PaError Pa_Initialize(void) {
+	return paNoError;
+}
+
+PaError Pa_Terminate(void) {
+	return paNoError;
+}
+
+PaDeviceIndex Pa_GetDeviceCount(void) {
+	return 1;
+}
+
+PaDeviceIndex Pa_GetDefaultOutputDevice(void) {
+	return 0;
+}
+
+const PaDeviceInfo* Pa_GetDeviceInfo(PaDeviceIndex device) {
+	return (device == 0) ? &device_info : NULL;
+}
+
+PaError Pa_OpenStream(PaStream** s,
+		const PaStreamParameters *inputParameters,
+		const PaStreamParameters *outputParameters,
+		double sampleRate,
+		unsigned long framesPerBuffer,
+		PaStreamFlags streamFlags,
+		PaStreamCallback *streamCallback,
+		void *userData)
+{
+	(void)inputParameters;
+	(void)streamFlags;
+
+	memset(&stream, 0, sizeof(fake_stream_t));
+	stream.callback          = streamCallback;
+	stream.user_data         = userData;
+	stream.output            = *outputParameters;
+	stream.sample_rate       = sampleRate;
+	stream.frames_per_buffer = framesPerBuffer;
+	stream.open              = true;
+
+	stream.info.structVersion = 1;
+	stream.info.sampleRate    = sampleRate;
+	stream.info.outputLatency = MAX(outputParameters->suggestedLatency, FAKE_DEVICE_LATENCY);
+	if (framesPerBuffer != paFramesPerBufferUnspecified) {
+		stream.info.outputLatency += framesPerBuffer / sampleRate;
+	}
+
+	*s = (PaStream*)&stream;
+	return paNoError;
+}
+
+PaError Pa_StartStream(PaStream *s) {
+	((fake_stream_t*)s)->started = true;
+	return paNoError;
+}
+
+PaError Pa_StopStream(PaStream *s) {
+	((fake_stream_t*)s)->started = false;
+	return paNoError;
+}
+
+PaError Pa_AbortStream(PaStream *s) {
+	return Pa_StopStream(s);
+}
+
+PaError Pa_CloseStream(PaStream *s) {
+	((fake_stream_t*)s)->open = false;
+	return paNoError;
+}
+
+const PaStreamInfo* Pa_GetStreamInfo(PaStream *s) {
+	return &((fake_stream_t*)s)->info;
+}
+
+PaTime Pa_GetStreamTime(PaStream *s) {
+	return ((fake_stream_t*)s)->stream_time;
+}
+
+double Pa_GetStreamCpuLoad(PaStream* s) {
+	return ((fake_stream_t*)s)->cpu_load;
+}
+
+PaError Pa_GetSampleSize(PaSampleFormat format) {
+	switch (format) {
+		case paFloat32: return 4;
+		case paInt32:   return 4;
+		case paInt24:   return 3;
+		case paInt16:   return 2;
+		default:        return paSampleFormatNotSupported;
+	}
+}
+
+const char *Pa_GetErrorText(PaError errorCode) {
+	return (errorCode == paNoError) ? "Success" : "Fake PortAudio error";
+}
+
+#ifdef __linux__
+void PaAlsa_EnableRealtimeScheduling(PaStream *s, int enable) {
+	(void)s;
+	(void)enable;
+}
+#endif
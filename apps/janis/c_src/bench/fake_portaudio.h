@@ -0,0 +1,38 @@
+#ifndef __FAKE_PORTAUDIO__
+#define __FAKE_PORTAUDIO__ 1
+
+#include <stdbool.h>
+#include <portaudio.h>
+
+// A stand-in for the PortAudio library used by the benchmark & simulation
+// tools. `Pa_OpenStream` just records the callback so that the tool can pump
+// it by hand with whatever clock it likes.
+
+#define FAKE_DEVICE_LATENCY (0.01) // s
+
+typedef struct fake_stream {
+	PaStreamCallback   *callback;
+	void               *user_data;
+	PaStreamParameters  output;
+	double              sample_rate;
+	unsigned long       frames_per_buffer;
+	bool                open;
+	bool                started;
+	// the suggested latency rounded up to the device's & plus a buffer
+	PaStreamInfo        info;
+
+	// whatever the tool wants `Pa_GetStreamCpuLoad` to report
+	double              cpu_load;
+	// the current time of the last callback pumped
+	PaTime              stream_time;
+} fake_stream_t;
+
+fake_stream_t *fake_portaudio_stream(void);
+
+int fake_portaudio_pump(
+		fake_stream_t                   *stream,
+		void                            *output,
+		unsigned long                    frame_count,
+		const PaStreamCallbackTimeInfo  *time_info);
+
+#endif
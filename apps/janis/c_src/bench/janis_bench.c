@@ -0,0 +1,254 @@
+// Offline benchmark for the audio callback.
+//
+// Runs the real driver (`portaudio_drv_start`, `PLAY_COMMAND`,
+// `audio_callback` → `send_packet` → libsamplerate → `src_input_callback`)
+// against the fake PortAudio in fake_portaudio.c. The stream's DAC clock is
+// virtual: every callback is told that its buffer will hit the DAC exactly
+// `frames played / sample rate` after the start of the run, so the sync code
+// behaves as if it were keeping up with a real device even though we pump it
+// as fast as we can. The audio's sent in whatever format the driver options
+// ask for, e.g. -o "sample_rate=96000 sample_bits=24 channels=8".
+//
+//     janis_bench [-b 64,256,1024] [-n callbacks] [-w warmup] [-v volume] [-o "driver options"]
+
+#include "../janis.h"
+
+#include <getopt.h>
+#include <time.h>
+
+#include "fake_portaudio.h"
+
+#define DEFAULT_BUFFER_SIZES "64,256,512,1024"
+#define DEFAULT_CALLBACKS    (20000)
+#define DEFAULT_WARMUP       (200)
+#define MAX_BUFFER_FRAMES    (8192)
+#define MAX_BUFFER_SIZES     (16)
+#define MAX_COMMAND_LENGTH   (512)
+// packets are 20ms, as sent by the broadcaster
+#define PACKET_CHUNKS        (2)
+#define MAX_PACKET_BYTES     (PACKET_CHUNKS * MAX_CHUNK_SIZE * 4)
+// keep the ring buffer topped up, leaving room for a couple of packets
+#define SPARE_CHUNKS         (2 * PACKET_CHUNKS)
+
+extern ErlDrvEntry example_driver_entry;
+
+typedef struct bench_options {
+	unsigned long buffer_sizes[MAX_BUFFER_SIZES];
+	int           buffer_size_count;
+	long          callbacks;
+	long          warmup;
+	float         volume;
+	char          command[MAX_COMMAND_LENGTH];
+} bench_options_t;
+
+typedef struct bench_stream {
+	ErlDrvData    drv;
+	uint64_t      start_time;  // µs, the virtual time of the first frame
+	uint64_t      next_packet; // µs
+	uint64_t      frames;      // total frames played
+	uint32_t      phase;
+	char          packet[10 + MAX_PACKET_BYTES];
+} bench_stream_t;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+	return (x > y) - (x < y);
+}
+
+static void control(bench_stream_t *bench, unsigned int cmd, char *buf, ErlDrvSizeT len) {
+	char  reply[64];
+	char *rbuf = reply;
+	example_driver_entry.control(bench->drv, cmd, buf, len, &rbuf, sizeof(reply));
+}
+
+static audio_callback_context *bench_context(bench_stream_t *bench) {
+	return ((portaudio_state*)bench->drv)->audio_context;
+}
+
+// a sample at half of full scale, little endian in the format's bits
+static char *write_sample(char *out, const stream_format_t *format, double value) {
+	int32_t s = (int32_t)lrint(value * 1073741824.0);
+
+	for (int b = 32 - format->sample_bits; b < 32; b += 8) {
+		*out++ = (char)((s >> b) & 0xff);
+	}
+	return out;
+}
+
+// a tone at a hundredth of the sample rate, 441Hz at 44.1kHz, which
+// conveniently fits into a packet exactly 20 times
+static void send_next_packet(bench_stream_t *bench) {
+	const stream_format_t *format = &bench_context(bench)->format;
+	unsigned long frames = PACKET_CHUNKS * format->chunk_frames;
+	uint64_t timestamp = htole64(bench->next_packet);
+	uint16_t len       = htole16((uint16_t)(frames * format->frame_bytes));
+	char    *samples   = bench->packet + 10;
+
+	memcpy(bench->packet, &timestamp, 8);
+	memcpy(bench->packet + 8, &len, 2);
+
+	for (unsigned long f = 0; f < frames; f++) {
+		double s = sin(2.0 * M_PI * (double)bench->phase++ / 100.0);
+		for (int c = 0; c < format->channels; c++) {
+			samples = write_sample(samples, format, s);
+		}
+	}
+	bench->phase %= 100;
+
+	control(bench, PLAY_COMMAND, bench->packet, (ErlDrvSizeT)(samples - bench->packet));
+
+	bench->next_packet += (uint64_t)llround(frames * format->us_per_frame);
+}
+
+static void fill_buffer(bench_stream_t *bench) {
+	audio_callback_context *context = bench_context(bench);
+	while (PaUtil_GetRingBufferWriteAvailable(&context->audio_buffer) > SPARE_CHUNKS) {
+		send_next_packet(bench);
+	}
+}
+
+static void fake_time_info(bench_stream_t *bench, PaStreamCallbackTimeInfo *time_info) {
+	// `send_packet` converts the DAC time into absolute time using its own
+	// reading of the monotonic clock, so bake the difference between that and
+	// our virtual clock into the DAC time.
+	const stream_format_t *format = &bench_context(bench)->format;
+	double   stream_time  = (double)bench->frames / format->sample_rate;
+	uint64_t virtual_time = bench->start_time + (uint64_t)llround((double)bench->frames * format->us_per_frame);
+	int64_t  skew         = (int64_t)(virtual_time - monotonic_microseconds());
+
+	time_info->inputBufferAdcTime  = 0.0;
+	time_info->currentTime         = stream_time;
+	time_info->outputBufferDacTime = stream_time + FAKE_DEVICE_LATENCY + ((double)skew / USECONDS);
+}
+
+static void run(bench_options_t *options, unsigned long frame_count) {
+	bench_stream_t bench;
+	fake_stream_t *stream = fake_portaudio_stream();
+	float         *out    = malloc(MAX_BUFFER_FRAMES * MAX_CHANNELS * sizeof(float));
+	uint64_t      *timing = malloc(options->callbacks * sizeof(uint64_t));
+	uint64_t       total  = 0;
+
+	memset(&bench, 0, sizeof(bench_stream_t));
+
+	bench.drv = example_driver_entry.start(NULL, options->command);
+
+	double period = (double)frame_count * bench_context(&bench)->format.us_per_frame * 1000.0; // ns
+
+	control(&bench, SVOL_COMMAND, (char*)&options->volume, sizeof(float));
+
+	bench.start_time  = monotonic_microseconds();
+	bench.next_packet = bench.start_time;
+
+	for (long n = -options->warmup; n < options->callbacks; n++) {
+		PaStreamCallbackTimeInfo time_info;
+
+		fill_buffer(&bench);
+		fake_time_info(&bench, &time_info);
+
+		uint64_t start = now_ns();
+		fake_portaudio_pump(stream, out, frame_count, &time_info);
+		uint64_t duration = now_ns() - start;
+
+		bench.frames += frame_count;
+
+		if (n >= 0) {
+			timing[n] = duration;
+			total += duration;
+			stream->cpu_load = (double)total / ((double)(n + 1) * period);
+		}
+	}
+
+	example_driver_entry.stop(bench.drv);
+
+	qsort(timing, options->callbacks, sizeof(uint64_t), compare_u64);
+
+	long   count = options->callbacks;
+	double mean  = (double)total / (double)count;
+
+	fprintf(stderr, "%6lu %9ld %10.0f %10.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8.3f%%\n",
+			frame_count,
+			count,
+			mean,
+			mean / (double)frame_count,
+			timing[count / 2],
+			timing[(count * 99) / 100],
+			timing[count - 1],
+			stream->cpu_load * 100.0);
+
+	free(timing);
+	free(out);
+}
+
+static int parse_buffer_sizes(bench_options_t *options, char *arg) {
+	char *token;
+	options->buffer_size_count = 0;
+	for (token = strtok(arg, ","); token != NULL; token = strtok(NULL, ",")) {
+		unsigned long size = strtoul(token, NULL, 10);
+		if (size == 0 || size > MAX_BUFFER_FRAMES || options->buffer_size_count == MAX_BUFFER_SIZES) {
+			return -1;
+		}
+		options->buffer_sizes[options->buffer_size_count++] = size;
+	}
+	return options->buffer_size_count > 0 ? 0 : -1;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-b frames[,frames...]] [-n callbacks] [-w warmup] [-v volume] [-o \"driver options\"]\n", name);
+}
+
+int main(int argc, char **argv) {
+	char default_sizes[] = DEFAULT_BUFFER_SIZES;
+	bench_options_t options = {
+		.callbacks = DEFAULT_CALLBACKS,
+		.warmup    = DEFAULT_WARMUP,
+		.volume    = 1.0f,
+		.command   = "janis"
+	};
+	int opt;
+
+	parse_buffer_sizes(&options, default_sizes);
+
+	while ((opt = getopt(argc, argv, "b:n:w:v:o:h")) != -1) {
+		switch (opt) {
+			case 'b':
+				if (parse_buffer_sizes(&options, optarg) != 0) {
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'n':
+				options.callbacks = MAX(1, atol(optarg));
+				break;
+			case 'w':
+				options.warmup = MAX(0, atol(optarg));
+				break;
+			case 'v':
+				options.volume = (float)atof(optarg);
+				break;
+			case 'o':
+				snprintf(options.command, MAX_COMMAND_LENGTH, "janis %s", optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	// results go to stderr so they don't get lost amongst the driver's
+	// chatter on stdout
+	fprintf(stderr, "# %s\n", options.command);
+	fprintf(stderr, "%6s %9s %10s %10s %8s %8s %8s %9s\n",
+			"frames", "callbacks", "ns/op", "ns/frame", "p50", "p99", "max", "cpu");
+
+	for (int i = 0; i < options.buffer_size_count; i++) {
+		run(&options, options.buffer_sizes[i]);
+	}
+
+	return 0;
+}
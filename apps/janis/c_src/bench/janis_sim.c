@@ -0,0 +1,408 @@
+// Offline simulation of the sync loop.
+//
+// Runs the real driver (`send_packet` → `pid_control` → the resampler)
+// against the fake PortAudio & a virtual DAC whose clock runs `-d` ppm fast
+// (or slow, if negative) against ours. Everything runs on virtual time, see
+// fake_monotonic_time.c, & the jitter comes from a seeded generator, so the
+// same options always give the same numbers & changes to the PID settings or
+// MAX_RESAMPLE_RATIO can be compared offline.
+//
+// Each callback runs up to `-j` µs late &, as with PortAudio's ALSA host
+// API, which works the DAC time out from when the callback runs, is told its
+// buffer will reach the DAC that much later too. `-s` steps the time delta
+// the driver's been given by that many µs, as a new sync measurement would.
+//
+// For each buffer size it reports the offset between the audio & where it
+// should be as the DAC actually plays it, i.e. what the driver measures less
+// the jitter, in µs:
+//
+// - settle: ms from the start of playback, or the last step, until the
+//   offset stays within ±`-e` µs for the rest of the run
+// - peak: the largest offset
+// - rms: over the whole run
+// - ppm: the mean resample ratio over the last second, less 1, which once
+//   settled should be close to the drift
+//
+// `-l` has the audio start that many ms before the receiver does, as when it
+// joins a stream that's already playing.
+//
+// With `-g` the exit status is 1 if any run is over the given limits, so
+// that tuning changes can be gated on regressions.
+//
+//     janis_sim [-b 64,256,1024] [-t seconds] [-d ppm] [-j jitter_us] [-s step_us@seconds[,...]]
+//         [-l late_ms] [-e tolerance_us] [-r seed] [-g settle_ms,peak_us,rms_us] [-o "driver options"]
+
+#include "../janis.h"
+
+#include <getopt.h>
+
+#include "fake_portaudio.h"
+#include "fake_monotonic_time.h"
+
+#define DEFAULT_BUFFER_SIZES "64,256,1024"
+#define DEFAULT_SECONDS      (60.0)
+#define DEFAULT_DRIFT_PPM    (50.0)
+#define DEFAULT_JITTER_US    (500.0)
+#define DEFAULT_TOLERANCE_US (100.0)
+#define DEFAULT_SEED         (1)
+#define MAX_BUFFER_FRAMES    (8192)
+#define MAX_BUFFER_SIZES     (16)
+#define MAX_STEPS            (16)
+#define MAX_COMMAND_LENGTH   (512)
+// the virtual clock starts well clear of 0, which pid_control treats as unset
+#define START_NS             (1000ULL * 1000000000ULL)
+// how far ahead of the first packet's time the run starts
+#define LEAD_US              (200000)
+// the end of the run the resample ratio's averaged over
+#define RATIO_SECONDS        (1.0)
+// packets are 20ms, as sent by the broadcaster
+#define PACKET_CHUNKS        (2)
+#define MAX_PACKET_BYTES     (PACKET_CHUNKS * MAX_CHUNK_SIZE * 4)
+// keep the ring buffer topped up, leaving room for a couple of packets
+#define SPARE_CHUNKS         (2 * PACKET_CHUNKS)
+// chunks go straight from the jitter buffer to the ring buffer rather than
+// waiting on the housekeeping thread, which runs on real time
+#define SIM_DRIVER_OPTIONS   "reorder_ms=0"
+
+extern ErlDrvEntry example_driver_entry;
+
+typedef struct sim_step {
+	double  at;       // s
+	int64_t delta_us;
+} sim_step_t;
+
+typedef struct sim_options {
+	unsigned long buffer_sizes[MAX_BUFFER_SIZES];
+	int           buffer_size_count;
+	double        seconds;
+	double        drift_ppm;
+	double        jitter_us;
+	double        late_ms;
+	double        tolerance_us;
+	uint64_t      seed;
+	sim_step_t    steps[MAX_STEPS];
+	int           step_count;
+	bool          gate;
+	double        gate_settle_ms;
+	double        gate_peak_us;
+	double        gate_rms_us;
+	char          command[MAX_COMMAND_LENGTH];
+} sim_options_t;
+
+typedef struct sim_stream {
+	ErlDrvData    drv;
+	uint64_t      next_packet; // µs
+	uint32_t      phase;
+	uint64_t      random;
+	char          packet[10 + MAX_PACKET_BYTES];
+} sim_stream_t;
+
+typedef struct sim_result {
+	bool          settled;
+	double        settle_ms;
+	double        peak_us;
+	double        rms_us;
+	double        ratio_ppm;
+} sim_result_t;
+
+static void control(sim_stream_t *sim, unsigned int cmd, char *buf, ErlDrvSizeT len) {
+	char  reply[64];
+	char *rbuf = reply;
+	example_driver_entry.control(sim->drv, cmd, buf, len, &rbuf, sizeof(reply));
+}
+
+static audio_callback_context *sim_context(sim_stream_t *sim) {
+	return ((portaudio_state*)sim->drv)->audio_context;
+}
+
+// xorshift64*, uniform in [0, 1)
+static double next_random(sim_stream_t *sim) {
+	sim->random ^= sim->random >> 12;
+	sim->random ^= sim->random << 25;
+	sim->random ^= sim->random >> 27;
+	return (double)((sim->random * 0x2545F4914F6CDD1DULL) >> 11) / (double)(1ULL << 53);
+}
+
+// a sample at half of full scale, little endian in the format's bits
+static char *write_sample(char *out, const stream_format_t *format, double value) {
+	int32_t s = (int32_t)lrint(value * 1073741824.0);
+
+	for (int b = 32 - format->sample_bits; b < 32; b += 8) {
+		*out++ = (char)((s >> b) & 0xff);
+	}
+	return out;
+}
+
+// a tone at a hundredth of the sample rate, 441Hz at 44.1kHz, which
+// conveniently fits into a packet exactly 20 times
+static void send_next_packet(sim_stream_t *sim) {
+	const stream_format_t *format = &sim_context(sim)->format;
+	unsigned long frames = PACKET_CHUNKS * format->chunk_frames;
+	uint64_t timestamp = htole64(sim->next_packet);
+	uint16_t len       = htole16((uint16_t)(frames * format->frame_bytes));
+	char    *samples   = sim->packet + 10;
+
+	memcpy(sim->packet, &timestamp, 8);
+	memcpy(sim->packet + 8, &len, 2);
+
+	for (unsigned long f = 0; f < frames; f++) {
+		double s = sin(2.0 * M_PI * (double)sim->phase++ / 100.0);
+		for (int c = 0; c < format->channels; c++) {
+			samples = write_sample(samples, format, s);
+		}
+	}
+	sim->phase %= 100;
+
+	control(sim, PLAY_COMMAND, sim->packet, (ErlDrvSizeT)(samples - sim->packet));
+
+	sim->next_packet += (uint64_t)llround(frames * format->us_per_frame);
+}
+
+static void fill_buffer(sim_stream_t *sim) {
+	audio_callback_context *context = sim_context(sim);
+	while (PaUtil_GetRingBufferWriteAvailable(&context->audio_buffer) > SPARE_CHUNKS) {
+		send_next_packet(sim);
+	}
+}
+
+static void set_time_delta(sim_stream_t *sim, int64_t delta) {
+	char     mapping[24];
+	uint64_t since = monotonic_microseconds();
+	double   slew  = 0.0;
+
+	memcpy(mapping, &delta, 8);
+	memcpy(mapping + 8, &since, 8);
+	memcpy(mapping + 16, &slew, 8);
+	control(sim, DELTA_COMMAND, mapping, sizeof(mapping));
+}
+
+static void run(sim_options_t *options, unsigned long frame_count, sim_result_t *result) {
+	sim_stream_t   sim;
+	fake_stream_t *stream    = fake_portaudio_stream();
+	float         *out       = malloc(MAX_BUFFER_FRAMES * MAX_CHANNELS * sizeof(float));
+	uint64_t       frames    = 0;
+	uint64_t       last_call = START_NS;
+	int64_t        delta     = 0;
+	int            step      = 0;
+	float          volume    = 1.0f;
+
+	double   squares    = 0.0;
+	uint64_t samples    = 0;
+	double   ratio      = 0.0;
+	uint64_t ratios     = 0;
+	double   disturbed  = -1.0; // s, when playback started or the last step
+	double   exceeded   = -1.0; // s, the last time the offset was out of tolerance
+	bool     within     = false;
+
+	memset(&sim, 0, sizeof(sim_stream_t));
+	memset(result, 0, sizeof(sim_result_t));
+
+	fake_monotonic_set(START_NS);
+
+	sim.random      = options->seed ? options->seed : DEFAULT_SEED;
+	sim.drv         = example_driver_entry.start(NULL, options->command);
+	sim.next_packet = START_NS / 1000 + LEAD_US - (uint64_t)llround(options->late_ms * 1000.0);
+
+	double dac_rate = sim_context(&sim)->format.sample_rate * (1.0 + options->drift_ppm / 1e6);
+
+	control(&sim, SVOL_COMMAND, (char*)&volume, sizeof(float));
+
+	for (;;) {
+		// when the first frame of this buffer reaches the DAC & when the
+		// callback for it runs
+		double   dac  = (double)frames / dac_rate + (double)LEAD_US / USECONDS;
+		double   late = next_random(&sim) * options->jitter_us / USECONDS;
+		uint64_t call = START_NS + (uint64_t)llround((dac - FAKE_DEVICE_LATENCY + late) * 1e9);
+
+		if (dac > options->seconds) { break; }
+
+		// a long enough delay could put this callback before the last
+		call = MAX(call, last_call);
+		last_call = call;
+
+		fake_monotonic_set(call);
+
+		double now = (double)(call - START_NS) / 1e9;
+
+		while (step < options->step_count && options->steps[step].at <= now) {
+			delta += options->steps[step++].delta_us;
+			set_time_delta(&sim, delta);
+			if (disturbed >= 0.0) { disturbed = now; }
+		}
+
+		fill_buffer(&sim);
+
+		PaStreamCallbackTimeInfo time_info;
+		time_info.inputBufferAdcTime  = 0.0;
+		time_info.currentTime         = now;
+		time_info.outputBufferDacTime = now + FAKE_DEVICE_LATENCY;
+
+		fake_portaudio_pump(stream, out, frame_count, &time_info);
+
+		frames += frame_count;
+
+		const metrics_callback_t *metrics = &sim_context(&sim)->callback_metrics;
+
+		if (!metrics->measured) { continue; }
+
+		if (disturbed < 0.0) { disturbed = now; }
+
+		// the driver's measurement is off by however late the callback ran
+		double error  = now + FAKE_DEVICE_LATENCY - dac;
+		double offset = fabs((double)metrics->offset_us + error * USECONDS);
+
+		squares += offset * offset;
+		samples++;
+		result->peak_us = MAX(result->peak_us, offset);
+
+		if (dac > options->seconds - RATIO_SECONDS) {
+			ratio += metrics->resample_ratio;
+			ratios++;
+		}
+
+		within = offset <= options->tolerance_us;
+		if (!within) { exceeded = now; }
+	}
+
+	example_driver_entry.stop(sim.drv);
+
+	result->settled   = samples > 0 && within;
+	result->settle_ms = (exceeded > disturbed) ? (exceeded - disturbed) * 1000.0 : 0.0;
+	result->rms_us    = samples > 0 ? sqrt(squares / (double)samples) : 0.0;
+	result->ratio_ppm = ratios > 0 ? (ratio / (double)ratios - 1.0) * 1e6 : 0.0;
+
+	free(out);
+}
+
+static bool within_gate(sim_options_t *options, sim_result_t *result) {
+	return result->settled &&
+		result->settle_ms <= options->gate_settle_ms &&
+		result->peak_us <= options->gate_peak_us &&
+		result->rms_us <= options->gate_rms_us;
+}
+
+static int parse_buffer_sizes(sim_options_t *options, char *arg) {
+	char *token;
+	options->buffer_size_count = 0;
+	for (token = strtok(arg, ","); token != NULL; token = strtok(NULL, ",")) {
+		unsigned long size = strtoul(token, NULL, 10);
+		if (size == 0 || size > MAX_BUFFER_FRAMES || options->buffer_size_count == MAX_BUFFER_SIZES) {
+			return -1;
+		}
+		options->buffer_sizes[options->buffer_size_count++] = size;
+	}
+	return options->buffer_size_count > 0 ? 0 : -1;
+}
+
+// step_us@seconds[,step_us@seconds...], in time order
+static int parse_steps(sim_options_t *options, char *arg) {
+	char *token;
+	options->step_count = 0;
+	for (token = strtok(arg, ","); token != NULL; token = strtok(NULL, ",")) {
+		sim_step_t step;
+		if (options->step_count == MAX_STEPS || sscanf(token, "%" SCNd64 "@%lf", &step.delta_us, &step.at) != 2) {
+			return -1;
+		}
+		if (options->step_count > 0 && step.at < options->steps[options->step_count - 1].at) {
+			return -1;
+		}
+		options->steps[options->step_count++] = step;
+	}
+	return 0;
+}
+
+static int parse_gate(sim_options_t *options, char *arg) {
+	options->gate = true;
+	return (sscanf(arg, "%lf,%lf,%lf", &options->gate_settle_ms, &options->gate_peak_us, &options->gate_rms_us) == 3) ? 0 : -1;
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-b frames[,frames...]] [-t seconds] [-d ppm] [-j jitter_us] [-s step_us@seconds[,...]] "
+			"[-l late_ms] [-e tolerance_us] [-r seed] [-g settle_ms,peak_us,rms_us] [-o \"driver options\"]\n", name);
+}
+
+int main(int argc, char **argv) {
+	char default_sizes[] = DEFAULT_BUFFER_SIZES;
+	sim_options_t options = {
+		.seconds      = DEFAULT_SECONDS,
+		.drift_ppm    = DEFAULT_DRIFT_PPM,
+		.jitter_us    = DEFAULT_JITTER_US,
+		.tolerance_us = DEFAULT_TOLERANCE_US,
+		.seed         = DEFAULT_SEED,
+		.command      = "janis " SIM_DRIVER_OPTIONS
+	};
+	int opt;
+	int failures = 0;
+
+	parse_buffer_sizes(&options, default_sizes);
+
+	while ((opt = getopt(argc, argv, "b:t:d:j:s:l:e:r:g:o:h")) != -1) {
+		int err = 0;
+		switch (opt) {
+			case 'b':
+				err = parse_buffer_sizes(&options, optarg);
+				break;
+			case 't':
+				options.seconds = atof(optarg);
+				break;
+			case 'd':
+				options.drift_ppm = atof(optarg);
+				break;
+			case 'j':
+				options.jitter_us = MAX(0.0, atof(optarg));
+				break;
+			case 's':
+				err = parse_steps(&options, optarg);
+				break;
+			case 'l':
+				options.late_ms = MAX(0.0, atof(optarg));
+				break;
+			case 'e':
+				options.tolerance_us = MAX(0.0, atof(optarg));
+				break;
+			case 'r':
+				options.seed = strtoull(optarg, NULL, 10);
+				break;
+			case 'g':
+				err = parse_gate(&options, optarg);
+				break;
+			case 'o':
+				snprintf(options.command, MAX_COMMAND_LENGTH, "janis " SIM_DRIVER_OPTIONS " %s", optarg);
+				break;
+			default:
+				err = -1;
+		}
+		if (err != 0) {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	// results go to stderr so they don't get lost amongst the driver's
+	// chatter on stdout
+	fprintf(stderr, "# %s, drift %.1fppm, jitter %.0fus, %d steps, %.0fms late, %.0fs\n",
+			options.command, options.drift_ppm, options.jitter_us, options.step_count, options.late_ms, options.seconds);
+	fprintf(stderr, "%6s %10s %10s %10s %10s\n", "frames", "settle_ms", "peak_us", "rms_us", "ppm");
+
+	for (int i = 0; i < options.buffer_size_count; i++) {
+		sim_result_t result;
+
+		run(&options, options.buffer_sizes[i], &result);
+
+		if (result.settled) {
+			fprintf(stderr, "%6lu %10.1f %10.1f %10.1f %10.2f",
+					options.buffer_sizes[i], result.settle_ms, result.peak_us, result.rms_us, result.ratio_ppm);
+		} else {
+			fprintf(stderr, "%6lu %10s %10.1f %10.1f %10.2f",
+					options.buffer_sizes[i], "never", result.peak_us, result.rms_us, result.ratio_ppm);
+		}
+
+		if (options.gate && !within_gate(&options, &result)) {
+			fprintf(stderr, "  FAIL");
+			failures++;
+		}
+		fprintf(stderr, "\n");
+	}
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,38 @@
+#include <string.h>
+#include <sched.h>
+
+#include "clock_map.h"
+#include "pa_memorybarrier.h"
+
+void clock_map_init(clock_map_t *map) {
+	map->sequence = 0;
+	memset(&map->mapping, 0, sizeof(clock_mapping_t));
+}
+
+void clock_map_set(clock_map_t *map, const clock_mapping_t *mapping) {
+	map->sequence++;
+	PaUtil_WriteMemoryBarrier();
+	map->mapping = *mapping;
+	PaUtil_WriteMemoryBarrier();
+	map->sequence++;
+}
+
+bool clock_map_try_read(clock_map_t *map, clock_mapping_t *out) {
+	clock_mapping_t copy;
+	uint32_t start = map->sequence;
+
+	if (start & 1) { return false; }
+	PaUtil_ReadMemoryBarrier();
+	copy = map->mapping;
+	PaUtil_ReadMemoryBarrier();
+	if (map->sequence != start) { return false; }
+
+	*out = copy;
+	return true;
+}
+
+void clock_map_read(clock_map_t *map, clock_mapping_t *out) {
+	while (!clock_map_try_read(map, out)) {
+		sched_yield();
+	}
+}
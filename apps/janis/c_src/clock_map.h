@@ -0,0 +1,37 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// Maps our monotonic clock onto the broadcaster's so that the audio can
+// keep the broadcaster's timestamps & a correction to the time delta takes
+// effect on the next callback rather than once the audio that was already
+// translated has played out.
+//
+//     broadcaster time = local + delta + slew * (local - since)
+//
+// The control thread is the only writer. The mapping is published through a
+// seqlock, like the metrics. The audio thread only tries once & keeps the
+// mapping it had if it catches the writer part way through, as it could
+// have preempted it.
+
+typedef struct {
+	int64_t  delta; // µs
+	uint64_t since; // local µs
+	double   slew;  // µs gained per µs, the broadcaster's clock skew
+} clock_mapping_t;
+
+typedef struct {
+	volatile uint32_t sequence;
+	clock_mapping_t   mapping;
+} clock_map_t;
+
+void clock_map_init(clock_map_t *map);
+void clock_map_set(clock_map_t *map, const clock_mapping_t *mapping);
+
+void clock_map_read(clock_map_t *map, clock_mapping_t *out);
+// returns false, leaving `out` alone, if the writer was busy
+bool clock_map_try_read(clock_map_t *map, clock_mapping_t *out);
+
+static inline uint64_t clock_map_to_broadcaster(const clock_mapping_t *m, uint64_t local) {
+	double slewed = m->slew * ((double)local - (double)m->since);
+	return (uint64_t)((int64_t)local + m->delta + (int64_t)slewed);
+}
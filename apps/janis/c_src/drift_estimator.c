@@ -0,0 +1,55 @@
+#include "drift_estimator.h"
+
+#include <math.h>
+
+void drift_estimator_init(drift_estimator_t *drift, double sample_rate, double time_constant, double min_seconds) {
+	drift->sample_rate   = sample_rate;
+	drift->time_constant = time_constant;
+	drift->min_seconds   = min_seconds;
+	drift_estimator_reset(drift);
+}
+
+void drift_estimator_reset(drift_estimator_t *drift) {
+	drift->started = false;
+	drift->valid   = false;
+	drift->drift   = 0.0;
+	drift->n = drift->sx = drift->sy = drift->sxx = drift->sxy = 0.0;
+}
+
+bool drift_estimator_update(drift_estimator_t *drift, uint64_t frames, double time) {
+	if (!drift->started) {
+		drift->started = true;
+		drift->first   = time;
+	} else {
+		double dx = time - drift->time;
+		double dy = (double)(frames - drift->frames) / drift->sample_rate;
+
+		if (dx <= 0.0) { return drift->valid; }
+
+		// move the origin to the new point...
+		drift->sxx += dx * (dx * drift->n - 2.0 * drift->sx);
+		drift->sxy += dx * dy * drift->n - dx * drift->sy - dy * drift->sx;
+		drift->sx  -= dx * drift->n;
+		drift->sy  -= dy * drift->n;
+
+		// ...& let the old points fade
+		double decay = exp(-dx / drift->time_constant);
+		drift->n   *= decay;
+		drift->sx  *= decay;
+		drift->sy  *= decay;
+		drift->sxx *= decay;
+		drift->sxy *= decay;
+	}
+	// the new point's at the origin so only adds to the count
+	drift->n     += 1.0;
+	drift->frames = frames;
+	drift->time   = time;
+
+	double det = drift->n * drift->sxx - drift->sx * drift->sx;
+
+	if (time - drift->first >= drift->min_seconds && det > 0.0) {
+		drift->drift = (drift->n * drift->sxy - drift->sx * drift->sy) / det - 1.0;
+		drift->valid = true;
+	}
+	return drift->valid;
+}
@@ -0,0 +1,35 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// Measures how fast the DAC's running against our monotonic clock from the
+// frames each callback hands it & when the first of them is due to play.
+//
+// A least squares fit of frames played (in seconds at the nominal rate)
+// against DAC time, with older points forgotten over `time_constant`
+// seconds. The callback's jitter is on the DAC time but averages out over
+// the thousands of points in the fit. The sums are kept relative to the
+// latest point so they stay small however long the stream's been running.
+
+typedef struct {
+	double   sample_rate;
+	double   time_constant;
+	// s of points needed before there's an estimate
+	double   min_seconds;
+
+	bool     started;
+	uint64_t frames;
+	double   time;
+	double   first;
+	double   n, sx, sy, sxx, sxy;
+	// the DAC's frames per frame of ours, less 1
+	bool     valid;
+	double   drift;
+} drift_estimator_t;
+
+void drift_estimator_init(drift_estimator_t *drift, double sample_rate, double time_constant, double min_seconds);
+// forgets everything, e.g. after the DAC's lost its place
+void drift_estimator_reset(drift_estimator_t *drift);
+// `frames` is the total sent to the DAC before this callback's & `time` when
+// the first of this callback's is due to play, in seconds. Returns true if
+// there's an estimate.
+bool drift_estimator_update(drift_estimator_t *drift, uint64_t frames, double time);
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver_options.h"
+
+// glibc's CPU_SETSIZE - 1
+#define MAX_CPU_INDEX      (1023)
+
+static const char *backend_names[] = {
+	[OUTPUT_BACKEND_PORTAUDIO] = "portaudio",
+	[OUTPUT_BACKEND_ALSA]      = "alsa",
+	[OUTPUT_BACKEND_NULL]      = "null",
+	[OUTPUT_BACKEND_FILE]      = "file"
+};
+
+static const char *format_names[] = {
+	[OUTPUT_FORMAT_FLOAT32] = "float32",
+	[OUTPUT_FORMAT_INT16]   = "int16",
+	[OUTPUT_FORMAT_INT32]   = "int32"
+};
+
+static const char *overflow_names[] = {
+	[OVERFLOW_REJECT] = "reject",
+	[OVERFLOW_EVICT]  = "evict"
+};
+
+// the rates that are a whole number of frames every 10ms, which the ring
+// buffer's chunks are
+static const unsigned long sample_rates[] = { 44100, 48000, 88200, 96000 };
+
+void driver_options_init(driver_options_t *options) {
+	options->sample_rate            = DEFAULT_SAMPLE_RATE;
+	options->sample_bits            = DEFAULT_SAMPLE_BITS;
+	options->channels               = DEFAULT_CHANNELS;
+	options->backend                = OUTPUT_BACKEND_PORTAUDIO;
+	options->device[0]              = '\0';
+	options->output_format          = OUTPUT_FORMAT_FLOAT32;
+	options->buffer_ms              = DEFAULT_BUFFER_MS;
+	options->frames_per_buffer      = 0;
+	options->latency_ms             = 0.0;
+	options->overflow               = OVERFLOW_REJECT;
+	options->high_watermark         = DEFAULT_HIGH_WATERMARK;
+	options->low_watermark          = DEFAULT_LOW_WATERMARK;
+	options->reorder_ms             = DEFAULT_REORDER_MS;
+	options->max_gap_ms             = DEFAULT_MAX_GAP_MS;
+	options->fast_start             = true;
+	options->passthrough_deadband   = 0.0;
+	options->resampler_chunk_frames = DEFAULT_RESAMPLER_CHUNK_FRAMES;
+	options->resampler_quality      = RESAMPLER_SINC_MEDIUM;
+	options->resampler_adaptive     = true;
+	options->cpu_load_high          = DEFAULT_CPU_LOAD_HIGH;
+	options->cpu_load_low           = DEFAULT_CPU_LOAD_LOW;
+	options->pid_feed_forward       = true;
+	options->pid_autotune           = false;
+
+	audio_thread_options_init(&options->audio_thread);
+}
+
+const char *driver_options_backend_name(output_backend_t backend) {
+	return backend_names[backend];
+}
+
+const char *driver_options_format_name(output_format_t format) {
+	return format_names[format];
+}
+
+const char *driver_options_overflow_name(overflow_policy_t overflow) {
+	return overflow_names[overflow];
+}
+
+static bool parse_double(const char *value, double *out) {
+	char *end;
+	double d = strtod(value, &end);
+	if (end == value || *end != '\0') { return false; }
+	*out = d;
+	return true;
+}
+
+static bool parse_ulong(const char *value, unsigned long min, unsigned long max, unsigned long *out) {
+	char *end;
+	unsigned long n = strtoul(value, &end, 10);
+	if (end == value || *end != '\0' || n < min || n > max) { return false; }
+	*out = n;
+	return true;
+}
+
+static bool parse_bool(const char *value, bool *out) {
+	if (strcmp(value, "true") == 0)  { *out = true;  return true; }
+	if (strcmp(value, "false") == 0) { *out = false; return true; }
+	return false;
+}
+
+// "last", "none" or a cpu index
+static bool parse_cpu(const char *value, int *out) {
+	unsigned long cpu;
+
+	if (strcmp(value, "last") == 0) { *out = AUDIO_CPU_LAST; return true; }
+	if (strcmp(value, "none") == 0) { *out = AUDIO_CPU_NONE; return true; }
+	if (!parse_ulong(value, 0, MAX_CPU_INDEX, &cpu)) { return false; }
+	*out = (int)cpu;
+	return true;
+}
+
+static bool parse_backend(const char *value, output_backend_t *out) {
+	for (size_t i = 0; i < sizeof(backend_names) / sizeof(backend_names[0]); i++) {
+		if (strcmp(value, backend_names[i]) == 0) {
+			*out = (output_backend_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool parse_string(const char *value, char *out, size_t size) {
+	if (strlen(value) >= size) { return false; }
+	strcpy(out, value);
+	return true;
+}
+
+static bool parse_format(const char *value, output_format_t *out) {
+	for (size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+		if (strcmp(value, format_names[i]) == 0) {
+			*out = (output_format_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool parse_sample_rate(const char *value, unsigned long *out) {
+	unsigned long rate;
+
+	if (!parse_ulong(value, 1, MAX_SAMPLE_RATE, &rate)) { return false; }
+
+	for (size_t i = 0; i < sizeof(sample_rates) / sizeof(sample_rates[0]); i++) {
+		if (rate == sample_rates[i]) {
+			*out = rate;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool parse_overflow(const char *value, overflow_policy_t *out) {
+	for (size_t i = 0; i < sizeof(overflow_names) / sizeof(overflow_names[0]); i++) {
+		if (strcmp(value, overflow_names[i]) == 0) {
+			*out = (overflow_policy_t)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool parse_fraction(const char *value, double *out) {
+	double d;
+	if (!parse_double(value, &d) || d < 0.0 || d > 1.0) { return false; }
+	*out = d;
+	return true;
+}
+
+static bool parse_option(driver_options_t *options, const char *key, const char *value) {
+	if (strcmp(key, "sample_rate") == 0) {
+		return parse_sample_rate(value, &options->sample_rate);
+	}
+	if (strcmp(key, "sample_bits") == 0) {
+		unsigned long bits;
+		if (!parse_ulong(value, 16, 32, &bits) || bits % 8 != 0) { return false; }
+		options->sample_bits = (int)bits;
+		return true;
+	}
+	if (strcmp(key, "channels") == 0) {
+		unsigned long channels;
+		if (!parse_ulong(value, 1, MAX_CHANNELS, &channels)) { return false; }
+		options->channels = (int)channels;
+		return true;
+	}
+	if (strcmp(key, "backend") == 0) {
+		return parse_backend(value, &options->backend);
+	}
+	if (strcmp(key, "device") == 0) {
+		return parse_string(value, options->device, sizeof(options->device));
+	}
+	if (strcmp(key, "output_format") == 0) {
+		return parse_format(value, &options->output_format);
+	}
+	if (strcmp(key, "buffer_ms") == 0) {
+		return parse_ulong(value, MIN_BUFFER_MS, MAX_BUFFER_MS, &options->buffer_ms);
+	}
+	if (strcmp(key, "frames_per_buffer") == 0) {
+		return parse_ulong(value, 0, MAX_FRAMES_PER_BUFFER, &options->frames_per_buffer);
+	}
+	if (strcmp(key, "latency_ms") == 0) {
+		return parse_double(value, &options->latency_ms) && options->latency_ms >= 0.0 && options->latency_ms <= MAX_LATENCY_MS;
+	}
+	if (strcmp(key, "overflow") == 0) {
+		return parse_overflow(value, &options->overflow);
+	}
+	if (strcmp(key, "high_watermark") == 0) {
+		return parse_fraction(value, &options->high_watermark);
+	}
+	if (strcmp(key, "low_watermark") == 0) {
+		return parse_fraction(value, &options->low_watermark);
+	}
+	if (strcmp(key, "reorder_ms") == 0) {
+		return parse_ulong(value, 0, MAX_REORDER_MS, &options->reorder_ms);
+	}
+	if (strcmp(key, "max_gap_ms") == 0) {
+		return parse_ulong(value, 0, MAX_BUFFER_MS, &options->max_gap_ms);
+	}
+	if (strcmp(key, "fast_start") == 0) {
+		return parse_bool(value, &options->fast_start);
+	}
+	if (strcmp(key, "passthrough_deadband") == 0) {
+		return parse_double(value, &options->passthrough_deadband) && options->passthrough_deadband >= 0.0;
+	}
+	if (strcmp(key, "resampler_chunk_frames") == 0) {
+		return parse_ulong(value, 1, RESAMPLER_INPUT_MAX_FRAMES, &options->resampler_chunk_frames);
+	}
+	if (strcmp(key, "resampler_quality") == 0) {
+		return resampler_quality_parse(value, &options->resampler_quality);
+	}
+	if (strcmp(key, "resampler_adaptive") == 0) {
+		return parse_bool(value, &options->resampler_adaptive);
+	}
+	if (strcmp(key, "cpu_load_high") == 0) {
+		return parse_double(value, &options->cpu_load_high) && options->cpu_load_high > 0.0;
+	}
+	if (strcmp(key, "cpu_load_low") == 0) {
+		return parse_double(value, &options->cpu_load_low) && options->cpu_load_low >= 0.0;
+	}
+	if (strcmp(key, "pid_feed_forward") == 0) {
+		return parse_bool(value, &options->pid_feed_forward);
+	}
+	if (strcmp(key, "pid_autotune") == 0) {
+		return parse_bool(value, &options->pid_autotune);
+	}
+	if (strcmp(key, "audio_cpu") == 0) {
+		return parse_cpu(value, &options->audio_thread.cpu);
+	}
+	if (strcmp(key, "sched_policy") == 0) {
+		return audio_thread_policy_parse(value, &options->audio_thread.policy);
+	}
+	if (strcmp(key, "sched_priority") == 0) {
+		unsigned long priority;
+		if (!parse_ulong(value, 0, 99, &priority)) { return false; }
+		options->audio_thread.priority = (int)priority;
+		return true;
+	}
+	if (strcmp(key, "sched_runtime_us") == 0) {
+		unsigned long runtime;
+		if (!parse_ulong(value, 1, UINT32_MAX, &runtime)) { return false; }
+		options->audio_thread.runtime_us = (uint32_t)runtime;
+		return true;
+	}
+	if (strcmp(key, "sched_period_us") == 0) {
+		unsigned long period;
+		if (!parse_ulong(value, 1, UINT32_MAX, &period)) { return false; }
+		options->audio_thread.period_us = (uint32_t)period;
+		return true;
+	}
+	if (strcmp(key, "isolate_audio_cpu") == 0) {
+		return parse_bool(value, &options->audio_thread.isolate);
+	}
+	return false;
+}
+
+int driver_options_parse(driver_options_t *options, const char *command) {
+	char  args[DRIVER_OPTIONS_MAX_LENGTH];
+	char *saveptr = NULL;
+	char *token;
+	int   errors = 0;
+
+	if (command == NULL) { return 0; }
+
+	strncpy(args, command, DRIVER_OPTIONS_MAX_LENGTH - 1);
+	args[DRIVER_OPTIONS_MAX_LENGTH - 1] = '\0';
+
+	for (token = strtok_r(args, " ", &saveptr); token != NULL; token = strtok_r(NULL, " ", &saveptr)) {
+		char *value = strchr(token, '=');
+
+		// the driver name
+		if (value == NULL) { continue; }
+
+		*value++ = '\0';
+
+		if (!parse_option(options, token, value)) {
+			fprintf(stderr, "\rDRV: invalid option %s=%s\r\n", token, value);
+			errors++;
+		}
+	}
+
+	if (options->low_watermark >= options->high_watermark) {
+		fprintf(stderr, "\rDRV: low_watermark must be below high_watermark\r\n");
+		options->low_watermark  = DEFAULT_LOW_WATERMARK;
+		options->high_watermark = DEFAULT_HIGH_WATERMARK;
+		errors++;
+	}
+	return errors;
+}
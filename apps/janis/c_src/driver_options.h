@@ -0,0 +1,136 @@
+#include <stdbool.h>
+
+#include "resampler.h"
+#include "audio_thread.h"
+
+#define RESAMPLER_INPUT_MAX_FRAMES     (1024)
+#define DEFAULT_RESAMPLER_CHUNK_FRAMES (256)
+#define DEFAULT_CPU_LOAD_HIGH          (0.8)
+#define DEFAULT_CPU_LOAD_LOW           (0.4)
+#define DEFAULT_BUFFER_MS              (640)
+#define MIN_BUFFER_MS                  (20)
+#define MAX_BUFFER_MS                  (20000)
+#define MAX_FRAMES_PER_BUFFER          (8192)
+#define MAX_LATENCY_MS                 (2000)
+#define DRIVER_OPTIONS_MAX_LENGTH      (1024)
+#define DEFAULT_HIGH_WATERMARK         (0.75)
+#define DEFAULT_REORDER_MS             (40)
+#define DEFAULT_MAX_GAP_MS             (200)
+#define MAX_REORDER_MS                 (1000)
+#define DEFAULT_LOW_WATERMARK          (0.25)
+#define MAX_DEVICE_LENGTH              (256)
+#define DEFAULT_SAMPLE_RATE            (44100)
+#define DEFAULT_SAMPLE_BITS            (16)
+#define DEFAULT_CHANNELS               (2)
+#define MAX_SAMPLE_RATE                (96000)
+#define MAX_CHANNELS                   (RESAMPLER_MAX_CHANNELS)
+
+// Settings passed to the driver as `key=value` pairs after the driver name
+// in the command given to open_port, e.g.
+//
+//     janis sample_rate=44100 sample_bits=16 channels=2 \
+//         backend=portaudio device= output_format=int16 buffer_ms=640 frames_per_buffer=0 latency_ms=0 \
+//         overflow=reject high_watermark=0.75 low_watermark=0.25 reorder_ms=40 max_gap_ms=200 \
+//         passthrough_deadband=0.0002 resampler_chunk_frames=256 \
+//         resampler_quality=medium resampler_adaptive=true cpu_load_high=0.8 cpu_load_low=0.4 \
+//         audio_cpu=last sched_policy=fifo sched_priority=0 isolate_audio_cpu=false \
+//         pid_feed_forward=true pid_autotune=false fast_start=true
+//
+// See Janis.Audio.PortAudio.driver_command/0. The same pairs can be sent
+// later with CONFIGURE_COMMAND, which reopens the stream with them.
+
+// what the audio goes out through, see pcm_output.h
+typedef enum {
+	OUTPUT_BACKEND_PORTAUDIO = 0,
+	// straight into the ALSA device's mmap ring
+	OUTPUT_BACKEND_ALSA,
+	// stand-ins for a sound card that keep time but play nothing, the file
+	// sink writes the audio out to `device`
+	OUTPUT_BACKEND_NULL,
+	OUTPUT_BACKEND_FILE
+} output_backend_t;
+
+typedef enum {
+	OUTPUT_FORMAT_FLOAT32 = 0,
+	OUTPUT_FORMAT_INT16,
+	OUTPUT_FORMAT_INT32
+} output_format_t;
+
+// what happens to new audio when the ring buffer is full
+typedef enum {
+	// drop the new audio & tell the sender
+	OVERFLOW_REJECT = 0,
+	// have the audio thread drop the oldest audio to make room
+	OVERFLOW_EVICT
+} overflow_policy_t;
+
+typedef struct {
+	// the format of the audio we're sent, which the stream's opened with:
+	// 44100, 48000, 88200 or 96000Hz, 16, 24 (packed in 3 bytes) or 32 bit
+	// little endian samples & 1 to MAX_CHANNELS interleaved channels
+	unsigned long   sample_rate;
+	int             sample_bits;
+	int             channels;
+	output_backend_t backend;
+	// the ALSA pcm for backend=alsa, empty for "default", or the file to
+	// write to for backend=file. PortAudio always uses its default device.
+	char            device[MAX_DEVICE_LENGTH];
+	// the sample format of the output stream
+	output_format_t output_format;
+	// the minimum amount of audio the ring buffer can hold
+	unsigned long   buffer_ms;
+	// the frames PortAudio passes to each callback, 0 lets it pick (and vary)
+	// the size. The other backends' period, 0 is 256 frames.
+	unsigned long   frames_per_buffer;
+	// the output latency asked of PortAudio, 0 uses the device's
+	// defaultLowOutputLatency, or the size of the other backends' buffer, 0
+	// is 4 periods. What we actually get may differ.
+	double          latency_ms;
+	overflow_policy_t overflow;
+	// the fractions of the ring buffer's capacity at which the port owner
+	// is told the buffer is filling up & then that it's drained enough to
+	// take more
+	double          high_watermark;
+	double          low_watermark;
+	// how long a chunk waits for any that should come before it to turn up,
+	// measured against the newest chunk's timestamp. Chunks that are nearly
+	// due go through regardless.
+	unsigned long   reorder_ms;
+	// the longest run of missing audio that's covered up rather than
+	// stopping playback & starting again. 0 stops as soon as we run out.
+	unsigned long   max_gap_ms;
+	// start playback on the exact frame the audio's due, skipping any that's
+	// already late & padding with silence up to it, rather than waiting for
+	// the first callback that's past the audio's time & starting there
+	bool            fast_start;
+	// while the resample ratio is within 1 ± this the audio is copied straight
+	// to the output & drift is corrected by dropping/repeating single frames.
+	// 0 always uses the resampler.
+	double          passthrough_deadband;
+	// the number of frames handed to the resampler at a time, up to
+	// RESAMPLER_INPUT_MAX_FRAMES
+	unsigned long   resampler_chunk_frames;
+	// the converter used by the resampler, which is also the best we'll go
+	// back up to after stepping down to something cheaper
+	resampler_quality_t resampler_quality;
+	// step down a quality tier when Pa_GetStreamCpuLoad stays above
+	// cpu_load_high & back up when it stays below cpu_load_low
+	bool            resampler_adaptive;
+	double          cpu_load_high;
+	double          cpu_load_low;
+	// correct the DAC's measured drift ahead of the PID, see drift_estimator.h
+	bool            pid_feed_forward;
+	// work the fine PID gains out over the first seconds of playback after
+	// the stream's opened rather than using the built in ones, see pid.h
+	bool            pid_autotune;
+	// the audio thread's cpu & scheduling: audio_cpu, sched_policy,
+	// sched_priority, sched_runtime_us, sched_period_us & isolate_audio_cpu
+	audio_thread_options_t audio_thread;
+} driver_options_t;
+
+void driver_options_init(driver_options_t *options);
+// returns the number of options that couldn't be parsed
+int  driver_options_parse(driver_options_t *options, const char *command);
+const char *driver_options_backend_name(output_backend_t backend);
+const char *driver_options_format_name(output_format_t format);
+const char *driver_options_overflow_name(overflow_policy_t overflow);
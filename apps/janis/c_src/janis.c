@@ -1,24 +1,100 @@
 #include "janis.h"
 
-
-// Not worth making this work on os x..
-#ifndef __APPLE__
-// Have we set cpu affinity & scheduling for our audio thread yet?
-static bool has_cpu_affinity = false;
-#endif // __APPLE__
-
 // configure these here because doing it in the header file breaks my make as I
 // don't have dependency checks.
+//
+// the fine gains hold small offsets & the coarse ones pull in large ones,
+// see pid.h. They were picked with janis_sim against a linear interpolating
+// stand-in for libsamplerate, so may want retuning on real hardware.
 #define PID_P (2.0)
-#define PID_I (0.05)
-#define PID_D (0.05)
-#define PID_DI_CUTOFF (100.0)
+#define PID_I (0.1)
+#define PID_D (0.0)
+#define PID_COARSE_P (8.0)
+#define PID_COARSE_I (0.0)
+#define PID_COARSE_D (0.0)
+#define PID_FINE_ERROR (50.0)
+#define PID_COARSE_ERROR (500.0)
+#define PID_TRACKING_S (1.0)
+#define PID_AUTOTUNE_S (3.0)
+#define PID_AUTOTUNE_NOISE_PPM (100.0)
+#define DRIFT_TIME_CONSTANT_S (20.0)
+#define DRIFT_MIN_S (2.0)
+
+// how often the housekeeping thread drains the audio thread's log
+#define HOUSEKEEPING_INTERVAL_US (20000)
+
+// for use on the audio thread instead of printf, see log_ring.h
+#define RT_LOG(context, ...) log_ring_printf(&(context)->log, __VA_ARGS__)
+
+static void commit_jitter_buffer(audio_callback_context *context);
+static void reset_jitter_buffer(audio_callback_context *context);
+
+static void reset_resampler(audio_callback_context *context) {
+	resampler_reset(&context->resampler);
+	context->resampler_lag = 0.0;
+}
+
+static void set_resampler_quality(audio_callback_context *context, resampler_quality_t quality) {
+	resampler_set_quality(&context->resampler, quality);
+	// whatever input the old converter was holding on to has gone
+	context->resampler_lag = 0.0;
+	context->load_frames   = 0;
+}
+
+// the fraction of the time between callbacks spent in them
+static double stream_cpu_load(audio_callback_context *context) {
+	if (context->options.backend != OUTPUT_BACKEND_PORTAUDIO) {
+		return pcm_output_cpu_load(&context->pcm_output);
+	}
+	return Pa_GetStreamCpuLoad(context->audio_stream);
+}
+
+// Steps the converter down a tier when the stream's cpu load has been above
+// cpu_load_high for QUALITY_DOWN_S seconds & back up towards the requested
+// quality when it's been below cpu_load_low for QUALITY_UP_S, both counted
+// in frames at the stream's sample rate. A change to the requested quality
+// is applied straight away.
+static void adapt_resampler_quality(audio_callback_context *context, unsigned long frames) {
+	resampler_quality_t quality   = context->resampler.quality;
+	resampler_quality_t requested = context->resampler_quality;
+
+	if (requested != context->resampler_ceiling) {
+		context->resampler_ceiling = requested;
+		RT_LOG(context, "Resampler quality %s", resampler_quality_name(requested));
+		set_resampler_quality(context, requested);
+		return;
+	}
+
+	if (!context->options.resampler_adaptive) { return; }
+
+	double load = stream_cpu_load(context);
+
+	if (load > context->options.cpu_load_high) {
+		context->load_frames = MAX(context->load_frames, 0) + (long)frames;
+	} else if (load < context->options.cpu_load_low) {
+		context->load_frames = MIN(context->load_frames, 0) - (long)frames;
+	} else {
+		context->load_frames = 0;
+	}
+
+	if (context->load_frames >= (long)(QUALITY_DOWN_S * context->format.sample_rate) && quality > RESAMPLER_LINEAR) {
+		RT_LOG(context, "!! cpu load %.2f%%, resampler quality %s", load * 100, resampler_quality_name(quality - 1));
+		set_resampler_quality(context, quality - 1);
+	} else if (context->load_frames <= -(long)(QUALITY_UP_S * context->format.sample_rate) && quality < requested) {
+		RT_LOG(context, "cpu load %.2f%%, resampler quality %s", load * 100, resampler_quality_name(quality + 1));
+		set_resampler_quality(context, quality + 1);
+	}
+}
 
 void playback_stopped(audio_callback_context *context) {
-	printf("Playback stopped...\r\n");
+	RT_LOG(context, "Playback stopped...");
 	context->playing     = false;
+	context->waiting     = false;
+	context->passthrough = false;
+	context->slip        = 0.0;
 	context->frame_count = (uint64_t)0;
-	src_reset(context->resampler);
+	context->concealing  = false;
+	reset_resampler(context);
 	pid_reset(&context->pid);
 	stream_stats_reset(context->timestamp_offset_stats);
 }
@@ -26,7 +102,15 @@ void playback_stopped(audio_callback_context *context) {
 bool load_next_packet(audio_callback_context *context)
 {
 	if (PaUtil_GetRingBufferReadAvailable(&context->audio_buffer) > 0) {
-		PaUtil_ReadRingBuffer(&context->audio_buffer, context->active_packet, 1);
+		timestamped_packet *packet = context->active_packet;
+
+		PaUtil_ReadRingBuffer(&context->audio_buffer, packet, 1);
+
+		uint64_t packet_end = packet->timestamp + (uint64_t)llround(packet->len * context->format.us_per_sample);
+
+		if (context->output_time > 0 && packet_end < context->output_time) {
+			context->callback_metrics.late_packets++;
+		}
 
 		return true;
 	}
@@ -52,11 +136,9 @@ long copy_packet_with_offset(
 	}
 
 	if (context->volume == (float)0.0) {
-		memset((out + outOffset), 0, len * context->sample_size);
+		memset((out + outOffset), 0, len * sizeof(float));
 	} else {
-		for (unsigned long i = 0; i < len; i++ ) {
-			*(out + outOffset + i) = context->volume * *(packet->data + packet->offset + i);
-		}
+		context->kernels->float_to_float(packet->data + packet->offset, out + outOffset, len, context->volume);
 	}
 
 	packet->offset = offset;
@@ -70,27 +152,346 @@ long copy_packet_with_offset(
 
 static long src_input_callback(void *cb_data, float **data) {
 		audio_callback_context *context = (audio_callback_context*)cb_data;
+		unsigned long len = context->options.resampler_chunk_frames * context->format.channels;
 		long sent = 0;
-		while ((sent < OUTPUT_BUFFER_SIZE) && CONTEXT_HAS_DATA(context)) {
-			sent += copy_packet_with_offset(context, context->buffer, OUTPUT_BUFFER_SIZE, sent);
+		while ((sent < (long)len) && CONTEXT_HAS_DATA(context)) {
+			sent += copy_packet_with_offset(context, context->buffer, len, sent);
 		}
 		*data = context->buffer;
 
-		return sent / CHANNEL_COUNT;
+		long frames = sent / context->format.channels;
+		context->resampler_lag += (double)frames;
+		return frames;
 }
 
+// `now` pairs the stream's time with the monotonic clock
 static inline uint64_t stream_time_to_absolute_time(
 		audio_callback_context *context,
-		uint64_t current_time,
+		const clock_pair_t *now,
 		const PaStreamCallbackTimeInfo*   timeInfo
 		) {
-	PaTime t = timeInfo->outputBufferDacTime - context->latency - timeInfo->currentTime;
-	return current_time + (uint64_t)llround(t * USECONDS);
+	return monotonic_pair_to_microseconds(now, timeInfo->outputBufferDacTime - context->latency);
+}
+
+
+static inline uint64_t packet_output_absolute_time(audio_callback_context *context, timestamped_packet *packet) {
+	return packet->timestamp + (uint64_t)llround(packet->offset * context->format.us_per_sample);
+}
+
+// the time of the next frame to be played, which is behind the position in
+// the active packet by whatever the resampler is holding on to
+static inline uint64_t playback_absolute_time(audio_callback_context *context) {
+	int64_t lag = (int64_t)llround(MAX(context->resampler_lag, 0.0) * context->format.us_per_frame);
+	return (uint64_t)((int64_t)packet_output_absolute_time(context, context->active_packet) - lag);
+}
+
+static inline void *output_offset(audio_callback_context *context, void *out, unsigned long frames) {
+	return (char*)out + (frames * context->format.channels * context->sample_size);
+}
+
+// writes float frames to the output in the stream's format, scaled by
+// `gain`. The volume for frames straight from the packets, 1 for the
+// resampler's, which has already applied it.
+static void write_output_frames(audio_callback_context *context, const float *in, void *out, unsigned long frames, float gain) {
+	size_t len = frames * context->format.channels;
+
+	switch (context->options.output_format) {
+		case OUTPUT_FORMAT_FLOAT32:
+			context->kernels->float_to_float(in, (float*)out, len, gain);
+			break;
+		case OUTPUT_FORMAT_INT16:
+			context->kernels->float_to_s16(in, (int16_t*)out, len, gain);
+			break;
+		case OUTPUT_FORMAT_INT32:
+			context->kernels->float_to_s32(in, (int32_t*)out, len, gain);
+			break;
+	}
+}
+
+static unsigned long resample_convert(audio_callback_context *context, double resample_ratio, unsigned long frame_count, void *out) {
+	if (context->options.output_format == OUTPUT_FORMAT_FLOAT32) {
+		long n = resampler_read(&context->resampler, resample_ratio, frame_count, (float*)out);
+		return n > 0 ? (unsigned long)n : 0;
+	}
+
+	unsigned long read = 0;
+
+	while (read < frame_count) {
+		long frames = (long)MIN(frame_count - read, RESAMPLE_BUFFER_FRAMES);
+		long n = resampler_read(&context->resampler, resample_ratio, frames, context->resample_buffer);
+
+		if (n <= 0) { break; }
+
+		write_output_frames(context, context->resample_buffer, output_offset(context, out, read), (unsigned long)n, 1.0f);
+		read += (unsigned long)n;
+
+		if (n < frames) { break; }
+	}
+	return read;
+}
+
+static unsigned long resample_read(audio_callback_context *context, double resample_ratio, unsigned long frame_count, void *out) {
+	unsigned long frames = resample_convert(context, resample_ratio, frame_count, out);
+
+	// the ratio is output/input
+	context->resampler_lag -= (double)frames / resample_ratio;
+	return frames;
+}
+
+static bool read_frame(audio_callback_context *context, float *frame, bool consume) {
+	if (!CONTEXT_HAS_DATA(context)) { return false; }
+
+	timestamped_packet *packet = context->active_packet;
+
+	memcpy(frame, packet->data + packet->offset, context->format.channels * sizeof(float));
+
+	if (consume) {
+		packet->offset += context->format.channels;
+		if (packet->offset == packet->len) {
+			load_next_packet(context);
+		}
+	}
+	return true;
+}
+
+// a frame half way between a & b
+static inline void blend_frames(const float *a, const float *b, float *out, int channels) {
+	for (int c = 0; c < channels; c++) {
+		out[c] = (a[c] + b[c]) * 0.5f;
+	}
+}
+
+// Plays the packets without resampling. The resample ratio is honoured by
+// occasionally dropping or repeating a frame, with the frame either side of
+// the join replaced by their midpoint to soften the step.
+static unsigned long passthrough_read(audio_callback_context *context, double resample_ratio, unsigned long frame_count, void *out) {
+	unsigned long written = 0;
+	int channels = context->format.channels;
+	size_t frame_size = channels * sizeof(float);
+	float a[MAX_CHANNELS], b[MAX_CHANNELS], blended[MAX_CHANNELS];
+
+	// the ratio is output/input so at this ratio we should be consuming
+	// frame_count / ratio input frames
+	context->slip += ((double)frame_count / resample_ratio) - (double)frame_count;
+
+	while (written < frame_count && CONTEXT_HAS_DATA(context)) {
+		if (context->slip >= 1.0) {
+			// behind: merge the next two frames into one
+			read_frame(context, a, true);
+			if (!read_frame(context, b, true)) {
+				memcpy(b, a, frame_size);
+			}
+			blend_frames(a, b, blended, channels);
+			write_output_frames(context, blended, output_offset(context, out, written), 1, context->volume);
+			memcpy(context->last_frame, b, frame_size);
+			context->slip -= 1.0;
+			written++;
+		} else if (context->slip <= -1.0) {
+			// ahead: insert a frame between the last one & the next
+			read_frame(context, a, false);
+			blend_frames(context->last_frame, a, blended, channels);
+			write_output_frames(context, blended, output_offset(context, out, written), 1, context->volume);
+			memcpy(context->last_frame, blended, frame_size);
+			context->slip += 1.0;
+			written++;
+		} else {
+			timestamped_packet *packet = context->active_packet;
+			unsigned long frames = MIN(frame_count - written, (unsigned long)(packet->len - packet->offset) / channels);
+
+			write_output_frames(context, packet->data + packet->offset, output_offset(context, out, written), frames, context->volume);
+			packet->offset += frames * channels;
+			memcpy(context->last_frame, packet->data + packet->offset - channels, frame_size);
+			written += frames;
+
+			if (packet->offset == packet->len) {
+				load_next_packet(context);
+			}
+		}
+	}
+	return written;
+}
+
+static bool use_passthrough(audio_callback_context *context, double resample_ratio) {
+	double deadband = context->options.passthrough_deadband;
+
+	if (deadband <= 0.0) { return false; }
+
+	if (context->passthrough) {
+		deadband *= PASSTHROUGH_EXIT_FACTOR;
+	}
+	return fabs(resample_ratio - 1.0) <= deadband;
+}
+
+// the time of the next frame to be played while concealing
+static inline uint64_t conceal_time(audio_callback_context *context) {
+	return context->conceal_position + (uint64_t)llround(context->concealed_frames * context->format.us_per_frame);
+}
+
+// Starts covering for missing audio with the chunk that's just run out.
+// Rather than restarting playback the clock carries on so that when the
+// audio turns up we can carry on from wherever we should be by then.
+static void start_concealment(audio_callback_context *context)
+{
+	timestamped_packet *packet = context->active_packet;
+
+	context->concealing             = true;
+	context->conceal_position       = playback_absolute_time(context);
+	context->concealed_frames       = 0;
+	context->conceal_pattern_frames = packet->len / context->format.channels;
+	memcpy(context->conceal_pattern, packet->data, packet->len * sizeof(float));
+
+	// anything the resampler was holding on to is now out of date
+	reset_resampler(context);
+	context->slip = 0.0;
+
+	context->callback_metrics.concealments++;
+	RT_LOG(context, "Concealing from %" PRIu64, context->conceal_position);
+}
+
+// Writes the pattern played backwards, fading out over CONCEAL_FADE_US, &
+// then silence. Going backwards from the last frame played means there's no
+// step at the join.
+static void conceal(audio_callback_context *context, void *out, unsigned long frame_count)
+{
+	float block[CONCEAL_BLOCK_FRAMES * MAX_CHANNELS];
+	int channels = context->format.channels;
+	unsigned long fade    = context->format.conceal_fade_frames;
+	unsigned long length  = context->conceal_pattern_frames;
+	unsigned long written = 0;
+
+	while (written < frame_count) {
+		unsigned long position = context->concealed_frames;
+
+		if (position >= fade || length == 0) {
+			memset(output_offset(context, out, written), 0, (frame_count - written) * channels * context->sample_size);
+			context->concealed_frames += frame_count - written;
+			break;
+		}
+
+		unsigned long n = MIN(frame_count - written, CONCEAL_BLOCK_FRAMES);
+
+		for (unsigned long f = 0; f < n; f++, position++) {
+			// back & forth through the pattern
+			unsigned long q     = position % (2 * length);
+			unsigned long frame = (q < length) ? (length - 1 - q) : (q - length);
+			float gain = (position < fade) ? 1.0f - (float)(position + 1) / fade : 0.0f;
+
+			for (int c = 0; c < channels; c++) {
+				block[f * channels + c] = context->conceal_pattern[frame * channels + c] * gain;
+			}
+		}
+		write_output_frames(context, block, output_offset(context, out, written), n, context->volume);
+		context->concealed_frames += n;
+		written += n;
+	}
+	context->callback_metrics.concealed_frames += frame_count;
+}
+
+// Carries on concealing until we've covered max_gap_ms, after which we give
+// up & wait to start again from scratch.
+static void continue_concealment(audio_callback_context *context, void *out, unsigned long frame_count)
+{
+	if (context->concealed_frames * context->format.us_per_frame >= context->options.max_gap_ms * 1000.0) {
+		RT_LOG(context, "Gap of %lu frames, giving up", context->concealed_frames);
+		playback_stopped(context);
+		memset(out, 0, frame_count * context->format.channels * context->sample_size);
+		return;
+	}
+	conceal(context, out, frame_count);
+}
+
+// fades the packet in over GAP_FADE_US from where it's got to, for when the
+// audio before it is missing or skipped
+static void fade_in(audio_callback_context *context, timestamped_packet *packet)
+{
+	int channels = context->format.channels;
+	long fade    = (long)context->format.gap_fade_frames;
+	long frames  = MIN((packet->len - packet->offset) / channels, fade);
+	float *data  = packet->data + packet->offset;
+
+	for (long f = 0; f < frames; f++) {
+		float gain = (float)(f + 1) / fade;
+		for (int c = 0; c < channels; c++) {
+			data[f * channels + c] *= gain;
+		}
+	}
+}
+
+// Picks up after a gap, skipping whatever's arrived for the time we've
+// already covered & fading back in. Returns false if none of the audio we
+// have is due before the end of this callback's `frame_count` frames.
+static bool resume_playback(audio_callback_context *context, unsigned long frame_count)
+{
+	uint64_t position = conceal_time(context);
+	uint64_t due      = position + (uint64_t)llround(frame_count * context->format.us_per_frame);
+	timestamped_packet *packet = context->active_packet;
+
+	do {
+		uint64_t end = packet->timestamp + (uint64_t)llround(packet->len * context->format.us_per_sample);
+
+		if (end > position) {
+			// still in the future, keep going until it's due
+			if (packet_output_absolute_time(context, packet) >= due) {
+				return false;
+			}
+
+			if (packet->timestamp < position) {
+				long skip = lround((position - packet->timestamp) * context->format.frames_per_us) * context->format.channels;
+				packet->offset = (uint16_t)MIN(skip, packet->len - context->format.channels);
+			}
+
+			fade_in(context, packet);
+
+			RT_LOG(context, "Resuming after %lu frames", context->concealed_frames);
+			context->concealing = false;
+			return true;
+		}
+	} while (load_next_packet(context));
+
+	packet->offset = packet->len;
+	return false;
+}
+
+// Drops whatever audio's due before `time`, moving on through the ring
+// buffer as packets run out. Returns false if it all was.
+static bool skip_to(audio_callback_context *context, uint64_t time)
+{
+	timestamped_packet *packet = context->active_packet;
+
+	do {
+		uint64_t end = packet->timestamp + (uint64_t)llround(packet->len * context->format.us_per_sample);
+
+		if (end > time) {
+			if (packet_output_absolute_time(context, packet) < time) {
+				long skip = lround((time - packet->timestamp) * context->format.frames_per_us) * context->format.channels;
+				packet->offset = (uint16_t)MIN(skip, packet->len - context->format.channels);
+			}
+			return true;
+		}
+	} while (load_next_packet(context));
+
+	packet->offset = packet->len;
+	return false;
 }
 
+// Lines the first frame we play up with the output to the nearest frame, so
+// that a receiver joining a running stream is in sync straight away rather
+// than leaving the PID to pull it in at MAX_RESAMPLE_RATIO. Audio that's
+// already late is skipped & faded in, & the buffer starts with however much
+// silence it takes until the audio's due. Returns the frames of silence or
+// -1 if nothing's due during this buffer's `frame_count`.
+static long align_start(audio_callback_context *context, uint64_t output_time, unsigned long frame_count)
+{
+	if (playback_absolute_time(context) < output_time) {
+		if (!skip_to(context, output_time)) { return -1; }
+		fade_in(context, context->active_packet);
+		RT_LOG(context, "Skipped to %" PRIu64, packet_output_absolute_time(context, context->active_packet));
+	}
+
+	int64_t lead   = (int64_t)(playback_absolute_time(context) - output_time);
+	long    frames = MAX(lround(lead * context->format.frames_per_us), 0);
 
-static inline uint64_t packet_output_absolute_time(timestamped_packet *packet) {
-	return packet->timestamp + (uint64_t)llround(packet->offset * USECONDS_PER_FLOAT);
+	return (frames < (long)frame_count) ? frames : -1;
 }
 
 // returns +ve if the packet is ahead of where it's supposed to be i.e. the audio is playing too fast
@@ -105,28 +506,56 @@ static inline uint64_t packet_output_absolute_time(timestamped_packet *packet) {
 
 
 static inline void send_packet(audio_callback_context *context,
-		float *out,
+		void *out,
 		unsigned long frameCount,
 		const PaStreamCallbackTimeInfo*   timeInfo
 		)
 {
 
-	uint64_t now = monotonic_microseconds();
+	// PortAudio reads the stream time just before calling us
+	clock_pair_t now = { monotonic_nanoseconds(), timeInfo->currentTime };
 	uint64_t output_time;
 	uint64_t packet_time;
 
-	output_time = stream_time_to_absolute_time(context, now, timeInfo);
-	packet_time = packet_output_absolute_time(context->active_packet);
+	// the audio's timestamps are on the broadcaster's clock. If the control
+	// thread's updating the mapping we carry on with the one we had.
+	clock_map_try_read(&context->clock_map, &context->mapping);
+	output_time = clock_map_to_broadcaster(&context->mapping, stream_time_to_absolute_time(context, &now, timeInfo));
+	context->output_time = output_time;
+	packet_time = playback_absolute_time(context);
 
 	if (context->playing == false) {
-		// we want to wait for the right time to start playing the packet
-		if (packet_time > output_time) {
+		long lead = 0;
+
+		if (context->options.fast_start) {
+			lead = align_start(context, output_time, frameCount);
+		} else if (packet_time > output_time) {
+			// wait for the callback the packet's due in
+			lead = -1;
+		}
+
+		if (lead < 0) {
 			// not our time... wait
-			printf("waiting %"PRIi64"\r\n", packet_time - output_time);
-			memset(out, 0, frameCount * CHANNEL_COUNT * context->sample_size);
+			if (!context->waiting) {
+				context->waiting = true;
+				RT_LOG(context, "waiting %"PRIi64, (int64_t)(playback_absolute_time(context) - output_time));
+			}
+			memset(out, 0, frameCount * context->format.channels * context->sample_size);
 			return;
 		}
+
+		if (lead > 0) {
+			memset(out, 0, lead * context->format.channels * context->sample_size);
+			out         = output_offset(context, out, (unsigned long)lead);
+			frameCount -= (unsigned long)lead;
+			output_time += (uint64_t)llround(lead * context->format.us_per_frame);
+			context->output_time = output_time;
+		}
+		packet_time = playback_absolute_time(context);
+
+		RT_LOG(context, "Playing, %ld frames of silence, offset %"PRIi64, lead, (int64_t)(packet_time - output_time));
 		context->playing = true;
+		context->waiting = false;
 	}
 
 	double resample_ratio = 1.0;
@@ -138,100 +567,155 @@ static inline void send_packet(audio_callback_context *context,
 	double smoothed_timestamp_offset = stream_stats_update(context->timestamp_offset_stats, packet_offset);
 
 	double control = 0.0;
-	double time    = ((double)now)/USECONDS;
+	double time    = ((double)now.monotonic_ns) / 1e9;
 
+	if (context->options.pid_feed_forward && context->dac_drift.valid) {
+		// a fast DAC needs more output for each frame of input
+		pid_set_feed_forward(&context->pid, -context->dac_drift.drift);
+	}
 	control = pid_control(&context->pid, time, packet_offset, 0.0);
-	control = MAX(control, -MAX_RESAMPLE_RATIO);
-	control = MIN(control, MAX_RESAMPLE_RATIO);
-	resample_ratio = 1.0 - control;
-
-	// tell src not to smoothly transition to the new resample ratio
-	src_set_ratio(context->resampler, resample_ratio);
+	if (pid_autotune_finished(&context->pid)) {
+		RT_LOG(context, "PID tuned: period %.2fms, noise %.1fus, kp %.3f ki %.3f",
+				context->pid.autotune.period * 1000.0, context->pid.autotune.noise, context->pid.fine.kp, context->pid.fine.ki);
+	}
+	// the PID only has to correct whatever the known skew doesn't
+	resample_ratio = 1.0 - control - context->mapping.slew;
+
+	metrics_callback_t *metrics = &context->callback_metrics;
+
+	metrics->measured           = true;
+	metrics->offset_us          = packet_offset;
+	metrics->smoothed_offset_us = smoothed_timestamp_offset;
+	metrics->resample_ratio     = resample_ratio;
+	metrics->pid_p              = context->pid.p;
+	metrics->pid_i              = context->pid.i;
+	metrics->pid_d              = context->pid.d;
+	metrics->pid_ff             = context->pid.feed_forward;
+	metrics->pid_kp             = context->pid.gains.kp;
+	metrics->pid_ki             = context->pid.gains.ki;
+	metrics->pid_kd             = context->pid.gains.kd;
+
+	bool passthrough = use_passthrough(context, resample_ratio);
+
+	if (passthrough != context->passthrough) {
+		// whichever way we're switching, the resampler's history is stale
+		reset_resampler(context);
+		context->slip        = 0.0;
+		context->passthrough = passthrough;
+	}
 
-	unsigned long frames = (unsigned long)src_callback_read(context->resampler, resample_ratio, frameCount, out);
+	unsigned long frames;
 
-	if (frames < frameCount) {
-		memset(out+(frames*CHANNEL_COUNT), 0, (frameCount - frames) * CHANNEL_COUNT * context->sample_size);
+	if (passthrough) {
+		frames = passthrough_read(context, resample_ratio, frameCount, out);
+	} else {
+		adapt_resampler_quality(context, frameCount);
+		frames = resample_read(context, resample_ratio, frameCount, out);
 	}
 
 	if (!CONTEXT_HAS_DATA(context)) {
-		playback_stopped(context);
+		if (context->options.max_gap_ms > 0) {
+			start_concealment(context);
+		} else {
+			playback_stopped(context);
+		}
+	}
+
+	if (frames < frameCount) {
+		metrics->underrun = true;
+		if (context->concealing) {
+			conceal(context, output_offset(context, out, frames), frameCount - frames);
+		} else {
+			memset(output_offset(context, out, frames), 0, (frameCount - frames) * context->format.channels * context->sample_size);
+		}
 	}
 
 	context->frame_count += frames;
 
-	if (frames == 0) {
-		int error = src_error(context->resampler);
+	if (frames == 0 && !passthrough) {
+		int error = resampler_error(&context->resampler);
 		if (error != 0) {
-			printf("SRC ERROR: %d '%s'\r\n", error, src_strerror(error));
+			RT_LOG(context, "SRC ERROR: %d '%s'", error, src_strerror(error));
 		}
 	}
+}
 
-	// debug at most every ~1s & only then once an individual packet's offset >
-	// this threshold.
-	const int64_t debug_threshold_us = 50; // µs
+static void publish_metrics(audio_callback_context *context, uint64_t callback_start) {
+	metrics_callback_t *metrics = &context->callback_metrics;
 
-	bool show_debug = false;
-	char* pre;
+	metrics->playing           = context->playing;
+	metrics->passthrough       = context->passthrough;
+	metrics->resampler_quality = context->resampler.quality;
+	metrics->fill_ms           = (long)(PaUtil_GetRingBufferReadAvailable(&context->audio_buffer) * CHUNK_MS);
+	metrics->cpu_load          = stream_cpu_load(context);
+	metrics->duration_ns       = monotonic_nanoseconds() - callback_start;
 
-	if (context->frame_count > (SAMPLE_RATE * 10)) {
-		show_debug = true;
-		pre = "   ";
-	}
-	if (context->frame_count > SAMPLE_RATE && llabs(packet_offset) > debug_threshold_us) {
-		show_debug = true;
-		pre = "!! ";
-	}
-	if (false && show_debug) {
-		context->frame_count = 0;
-		double load = Pa_GetStreamCpuLoad(context->audio_stream) * 100;
-		printf ("%s % 9.2f,% 6"PRIi64",% 8.6f,% 7.2f%% - {%.5f, %.5f, %.5f}\r\n", pre, smoothed_timestamp_offset, packet_offset, resample_ratio, load, context->pid.kp, context->pid.ki, context->pid.kd);
+	metrics_publish(&context->metrics, metrics);
+}
+
+// drops the oldest chunks, as asked for by make_room with overflow=evict
+static void evict_chunks(audio_callback_context *context)
+{
+	uint32_t pending = context->evict_requested - context->evicted;
+
+	if (pending == 0) { return; }
+
+	ring_buffer_size_t available = PaUtil_GetRingBufferReadAvailable(&context->audio_buffer);
+	ring_buffer_size_t count = MIN((ring_buffer_size_t)pending, available);
+
+	if (count > 0) {
+		PaUtil_AdvanceRingBufferReadIndex(&context->audio_buffer, count);
+		RT_LOG(context, "Evicted %ld", (long)count);
 	}
+	context->evicted += pending;
+}
+
+// feeds the frames handed to the DAC & when they'll play to the drift
+// estimator, starting again if it's had an underflow
+static void measure_dac_drift(audio_callback_context *context,
+		unsigned long                     frameCount,
+		const PaStreamCallbackTimeInfo*   timeInfo,
+		PaStreamCallbackFlags             statusFlags)
+{
+	clock_pair_t now = { monotonic_nanoseconds(), timeInfo->currentTime };
 
+	if (statusFlags & paOutputUnderflow) {
+		drift_estimator_reset(&context->dac_drift);
+	}
+	drift_estimator_update(&context->dac_drift, context->dac_frames,
+			(double)monotonic_pair_to_microseconds(&now, timeInfo->outputBufferDacTime) / USECONDS);
+	context->dac_frames += frameCount;
 }
 
 static int audio_callback(const void* _input,
 		void*                             output,
 		unsigned long                     frameCount,
 		const PaStreamCallbackTimeInfo*   timeInfo,
-		PaStreamCallbackFlags             _statusFlags,
+		PaStreamCallbackFlags             statusFlags,
 		void*                             userData)
 {
 	audio_callback_context* context = (audio_callback_context*)userData;
-	float *out = (float*)output;
+	void *out = output;
 	timestamped_packet* packet = NULL;
+	uint64_t callback_start = monotonic_nanoseconds();
 
-	UNUSED(_input);
-	UNUSED(_statusFlags);
-
-#ifndef __APPLE__
-	if (!has_cpu_affinity) {
-		has_cpu_affinity = true;
-
-		cpu_set_t cpus;
-		struct sched_param sched_param;
-		sched_param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	memset(&context->callback_metrics, 0, sizeof(metrics_callback_t));
 
-		int processor_count = sysconf(_SC_NPROCESSORS_ONLN);
-
-		printf("=== Setting cpu affinity: CPU %d/%d SCHED_FIFO %d\r\n", processor_count, processor_count, sched_param.sched_priority);
+	UNUSED(_input);
 
-		pthread_t current_thread = pthread_self();
+	// the housekeeping thread sets our affinity & scheduling
+	audio_thread_capture(&context->audio_thread);
 
-		CPU_ZERO(&cpus);
-		CPU_SET(processor_count - 1, &cpus);
+	measure_dac_drift(context, frameCount, timeInfo, statusFlags);
 
-		pthread_setaffinity_np(current_thread, sizeof(cpu_set_t), &cpus);
-		pthread_setschedparam(current_thread, SCHED_FIFO, &sched_param);
-	}
-#endif // __APPLE__
+	evict_chunks(context);
 
 	if (context->stopped) {
 		// remove all things from the ring buffer
-		timestamped_packet _packet;
-		while (PaUtil_GetRingBufferReadAvailable(&context->audio_buffer) > 0) {
-			printf("Popping %ld\n\r", (long)PaUtil_GetRingBufferReadAvailable(&context->audio_buffer));
-			PaUtil_ReadRingBuffer(&context->audio_buffer, &_packet, 1);
+		ring_buffer_size_t available = PaUtil_GetRingBufferReadAvailable(&context->audio_buffer);
+		if (available > 0) {
+			RT_LOG(context, "Popping %ld", (long)available);
+			PaUtil_AdvanceRingBufferReadIndex(&context->audio_buffer, available);
 		}
 		playback_stopped(context);
 		context->stopped = false;
@@ -244,29 +728,96 @@ static int audio_callback(const void* _input,
 			}
 		}
 	}
-	if (packet == NULL) {
-		memset(out, 0, frameCount * CHANNEL_COUNT * context->sample_size);
-	} else {
+	if (packet != NULL && context->concealing && !resume_playback(context, frameCount)) {
+		packet = NULL;
+	}
+
+	if (packet != NULL) {
 		send_packet(context, out, frameCount, timeInfo);
+	} else if (context->concealing) {
+		continue_concealment(context, out, frameCount);
+	} else {
+		memset(out, 0, frameCount * context->format.channels * context->sample_size);
 	}
+
+	publish_metrics(context, callback_start);
+
 	return paContinue;
 }
 
-PaError initialize_audio_stream(audio_callback_context* context)
+// sends {Port, {audio_buffer, Event, Value}} to the port owner. Safe to call
+// from the housekeeping thread.
+static void send_buffer_event(audio_callback_context *context, ErlDrvTermData event, long value)
 {
-	PaStream*           stream;
-	PaError             err;
-	PaStreamParameters  outputParameters;
-	bool has_initialized = false;
+	ErlDrvTermData term[] = {
+		ERL_DRV_PORT,  context->port_term,
+		ERL_DRV_ATOM,  context->atom_audio_buffer,
+		ERL_DRV_ATOM,  event,
+		ERL_DRV_INT,   (ErlDrvTermData)value,
+		ERL_DRV_TUPLE, 3,
+		ERL_DRV_TUPLE, 2
+	};
+	erl_drv_output_term(context->port_term, term, sizeof(term) / sizeof(term[0]));
+}
 
-	printf("== Pa_Initialize...\r\n");
+// tells the port owner when the ring buffer fills past the high watermark
+// & then when it's drained back below the low one, so it can hold off
+// sending audio in between
+static void check_watermarks(audio_callback_context *context)
+{
+	ring_buffer_size_t fill = PaUtil_GetRingBufferReadAvailable(&context->audio_buffer);
+	double fraction = (double)fill / context->buffer_chunks;
+	long fill_ms = lround(fill * CHUNK_MS);
+
+	if (!context->above_high_watermark && fraction >= context->options.high_watermark) {
+		context->above_high_watermark = true;
+		send_buffer_event(context, context->atom_high_watermark, fill_ms);
+	} else if (context->above_high_watermark && fraction <= context->options.low_watermark) {
+		context->above_high_watermark = false;
+		send_buffer_event(context, context->atom_low_watermark, fill_ms);
+	}
+}
 
-	err = Pa_Initialize();
-	if (err != paNoError) { goto error; }
+// Does the work the audio thread mustn't: writing out its log, setting up
+// its cpu affinity & scheduling once it's started, moving chunks from the
+// jitter buffer into the ring buffer as they come due & keeping an eye on
+// the ring buffer's watermarks.
+static void *housekeeping(void *arg) {
+	audio_callback_context *context = (audio_callback_context*)arg;
 
-	printf("== Pa_Initialize complete\r\n");
+	while (context->housekeeping_running) {
+		if (audio_thread_pending(&context->audio_thread)) {
+			audio_thread_configure(&context->audio_thread, &context->options.audio_thread);
+		}
+		commit_jitter_buffer(context);
+		check_watermarks(context);
+		log_ring_drain(&context->log, stdout);
+		usleep(HOUSEKEEPING_INTERVAL_US);
+	}
+	log_ring_drain(&context->log, stdout);
+	return NULL;
+}
+
+static int start_housekeeping(audio_callback_context *context) {
+	context->housekeeping_running = true;
+	return erl_drv_thread_create("janis_housekeeping", &context->housekeeping_tid, housekeeping, context, NULL);
+}
 
-	has_initialized = true;
+static void stop_housekeeping(audio_callback_context *context) {
+	context->housekeeping_running = false;
+	erl_drv_thread_join(context->housekeeping_tid, NULL);
+}
+
+static double read_stream_time(void *stream)
+{
+	return Pa_GetStreamTime((PaStream *)stream);
+}
+
+static PaError open_portaudio_stream(audio_callback_context* context)
+{
+	PaStream*           stream;
+	PaError             err;
+	PaStreamParameters  outputParameters;
 
 	int numDevices, i;
 	numDevices = Pa_GetDeviceCount();
@@ -281,32 +832,51 @@ PaError initialize_audio_stream(audio_callback_context* context)
 
 	if (outputParameters.device == paNoDevice) {
 		fprintf(stderr,"\rError: No default output device.\r\n");
-		goto error;
+		return paInvalidDevice;
 	}
 
 	deviceInfo = Pa_GetDeviceInfo(outputParameters.device);
 
 	printf("== Using Device %s\r\n", deviceInfo->name);
 
-	outputParameters.channelCount = CHANNEL_COUNT;                     /* Stereo output, most likely supported. */
+	outputParameters.channelCount = context->format.channels;
 	outputParameters.hostApiSpecificStreamInfo = NULL;
-	outputParameters.sampleFormat = paFloat32;             /* 32 bit floating point output. */
+	switch (context->options.output_format) {
+		case OUTPUT_FORMAT_INT16:
+			outputParameters.sampleFormat = paInt16;
+			break;
+		case OUTPUT_FORMAT_INT32:
+			outputParameters.sampleFormat = paInt32;
+			break;
+		default:
+			outputParameters.sampleFormat = paFloat32;             /* 32 bit floating point output. */
+	}
+	printf("== Output format %s\r\n", driver_options_format_name(context->options.output_format));
 	// I don't particularly need a low latency, I need a consistent latency
 	// the two given options are 'defaultLowOutputLatency' and 'defaultHighOutputLatency'
-	PaTime latency = Pa_GetDeviceInfo(outputParameters.device)->defaultLowOutputLatency;
+	// unless we've been given something else
+	PaTime latency = deviceInfo->defaultLowOutputLatency;
+	if (context->options.latency_ms > 0.0) {
+		latency = context->options.latency_ms / 1000.0;
+	}
 	printf("Using latency %f\r\n", latency);
 	outputParameters.suggestedLatency = latency;
 
+	unsigned long frames_per_buffer = context->options.frames_per_buffer;
+	if (frames_per_buffer == 0) {
+		frames_per_buffer = paFramesPerBufferUnspecified;
+	}
+
 	err = Pa_OpenStream(&stream,
 			NULL,                              // No input.
 			&outputParameters,
-			SAMPLE_RATE,                       // Sample rate.
-			paFramesPerBufferUnspecified,      // Frames per buffer.
+			context->format.sample_rate,       // Sample rate.
+			frames_per_buffer,                 // Frames per buffer.
 			paDitherOff,                       // Clip but don't dither
 			audio_callback,
 			context);
 
-	if (err != paNoError) { goto error; }
+	if (err != paNoError) { return err; }
 
 #ifdef __alsa__
 	printf("== Enabling realtime scheduling...\r\n");
@@ -315,6 +885,10 @@ PaError initialize_audio_stream(audio_callback_context* context)
 
 	context->latency = latency;
 
+	const PaStreamInfo *info = Pa_GetStreamInfo(stream);
+	context->granted_latency = (info != NULL) ? info->outputLatency : latency;
+	printf("Granted latency %f\r\n", context->granted_latency);
+
 	context->audio_stream = stream;
 
 	err = Pa_GetSampleSize(outputParameters.sampleFormat);
@@ -327,49 +901,261 @@ PaError initialize_audio_stream(audio_callback_context* context)
 
 	if (err != paNoError) { goto error; }
 
-	/* PaTime stream_time = Pa_GetStreamTime(stream); */
-	/*  */
-	/* if (stream_time == 0) { goto error; } */
+	clock_pair_t start;
+	monotonic_pair(&start, read_stream_time, stream);
 
-	context->stream_start_time = monotonic_microseconds();
+	context->stream_start_time = start.monotonic_ns / 1000;
 
-	printf("stream start at %" PRIu64 "\r\n", context->stream_start_time);
+	printf("stream start at %" PRIu64 " (stream time %f)\r\n", context->stream_start_time, start.time);
 
 	return paNoError;
 
 error:
-	if (has_initialized) {
-		Pa_Terminate();
+	Pa_CloseStream(stream);
+	context->audio_stream = NULL;
+	return err;
+}
+
+// backend=alsa, null or file. The stream time is the monotonic clock so
+// the callback's timings need no conversion.
+static PaError open_pcm_output(audio_callback_context* context)
+{
+	output_backend_t backend = context->options.backend;
+
+	printf("== Using %s output %s\r\n", driver_options_backend_name(backend), context->options.device);
+	printf("== Output format %s\r\n", driver_options_format_name(context->options.output_format));
+
+	double latency = context->options.latency_ms / 1000.0;
+
+	pcm_sink_t sink = (backend == OUTPUT_BACKEND_ALSA) ? PCM_OUTPUT_ALSA :
+		(backend == OUTPUT_BACKEND_FILE) ? PCM_OUTPUT_FILE : PCM_OUTPUT_NULL;
+	output_format_t format = context->options.output_format;
+
+	int err = pcm_output_open(&context->pcm_output, sink, context->options.device,
+			(format == OUTPUT_FORMAT_INT16) ? 2 : 4, format == OUTPUT_FORMAT_FLOAT32,
+			context->format.sample_rate, context->format.channels, context->options.frames_per_buffer, latency,
+			audio_callback, context);
+
+	if (err < 0) {
+		fprintf(stderr, "\rError opening %s output: %s\r\n", driver_options_backend_name(backend), pcm_output_error(err));
+		return paDeviceUnavailable;
+	}
+
+	// the thread calls audio_callback as soon as it starts
+	context->granted_latency = pcm_output_latency(&context->pcm_output);
+	context->latency         = (latency > 0.0) ? latency : context->granted_latency;
+	context->sample_size     = context->pcm_output.sample_size;
+
+	printf("Granted latency %f\r\n", context->granted_latency);
+
+	err = pcm_output_start(&context->pcm_output);
+
+	if (err < 0) {
+		fprintf(stderr, "\rError starting %s output: %s\r\n", driver_options_backend_name(backend), pcm_output_error(err));
+		pcm_output_close(&context->pcm_output);
+		return paDeviceUnavailable;
 	}
+
+	clock_pair_t start;
+	monotonic_pair(&start, pcm_output_time, &context->pcm_output);
+
+	context->stream_start_time = start.monotonic_ns / 1000;
+
+	printf("stream start at %" PRIu64 "\r\n", context->stream_start_time);
+
+	return paNoError;
+}
+
+// A new stream may be on a different device or have a different period, so
+// the DAC's drift is measured afresh & the PID's gains start over, to be
+// tuned again if pid_autotune's set. The audio thread mustn't be running.
+static void init_controller(audio_callback_context* context)
+{
+	pid_gains_t fine   = { PID_P, PID_I, PID_D };
+	pid_gains_t coarse = { PID_COARSE_P, PID_COARSE_I, PID_COARSE_D };
+
+	pid_init(&context->pid, fine, coarse, PID_FINE_ERROR, PID_COARSE_ERROR, MAX_RESAMPLE_RATIO, PID_TRACKING_S);
+
+	if (context->options.pid_autotune) {
+		pid_autotune_start(&context->pid, PID_AUTOTUNE_S, PID_AUTOTUNE_NOISE_PPM);
+	}
+	drift_estimator_init(&context->dac_drift, context->format.sample_rate, DRIFT_TIME_CONSTANT_S, DRIFT_MIN_S);
+	context->dac_frames = 0;
+}
+
+// opens & starts the stream with the current options. PortAudio must already
+// be initialised.
+static PaError open_audio_stream(audio_callback_context* context)
+{
+	init_controller(context);
+
+	printf("== Stream format %.0fHz, %d bit, %d channels\r\n",
+			context->format.sample_rate, context->format.sample_bits, context->format.channels);
+
+	if (context->options.backend != OUTPUT_BACKEND_PORTAUDIO) {
+		return open_pcm_output(context);
+	}
+	return open_portaudio_stream(context);
+}
+
+static PaError close_audio_stream(audio_callback_context *context)
+{
+	PaError err;
+
+	if (context->options.backend != OUTPUT_BACKEND_PORTAUDIO) {
+		pcm_output_close(&context->pcm_output);
+		return paNoError;
+	}
+	// a failed reconfigure can leave us without one
+	if (context->audio_stream == NULL) { return paNoError; }
+
+	err = Pa_AbortStream(context->audio_stream);
+	if (err != paNoError) { return err; }
+	err = Pa_CloseStream(context->audio_stream);
+	context->audio_stream = NULL;
+	return err;
+}
+
+static void print_pa_error(PaError err)
+{
 	fprintf( stderr, "\rAn error occured while using the portaudio stream\r\n" );
 	fprintf( stderr, "\rError number: %d\r\n", err );
 	fprintf( stderr, "\rError message: %s\r\n", Pa_GetErrorText( err ) );
+}
 
+PaError initialize_audio_stream(audio_callback_context* context)
+{
+	PaError             err;
+
+	printf("== Pa_Initialize...\r\n");
+
+	err = Pa_Initialize();
+	if (err != paNoError) { goto error; }
+
+	printf("== Pa_Initialize complete\r\n");
+
+	err = open_audio_stream(context);
+	if (err != paNoError) {
+		Pa_Terminate();
+		goto error;
+	}
+	return paNoError;
+
+error:
+	print_pa_error(err);
 	return err;
 }
 
+// enough chunks for buffer_ms of audio, rounded up to a power of 2
+static ring_buffer_size_t buffer_chunks(unsigned long buffer_ms)
+{
+	ring_buffer_size_t chunks = 1;
+	double needed = ceil((double)buffer_ms / CHUNK_MS);
+
+	while (chunks < needed) {
+		chunks <<= 1;
+	}
+	return chunks;
+}
+
+// a timestamped_packet holding `samples`, rounded up so that the ring
+// buffer's slots keep the timestamps aligned
+static size_t packet_bytes(unsigned long samples)
+{
+	size_t bytes = offsetof(timestamped_packet, data) + samples * sizeof(float);
+	return (bytes + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+}
+
+// works out everything that follows from the options' sample format
+static void stream_format_init(stream_format_t *format, const driver_options_t *options)
+{
+	format->sample_rate         = (double)options->sample_rate;
+	format->channels            = options->channels;
+	format->sample_bits         = options->sample_bits;
+	format->sample_bytes        = (size_t)options->sample_bits / 8;
+	format->frame_bytes         = format->sample_bytes * options->channels;
+	format->chunk_frames        = (unsigned long)lround(format->sample_rate * CHUNK_MS / 1000.0);
+	format->chunk_size          = format->chunk_frames * options->channels;
+	format->packet_bytes        = packet_bytes(format->chunk_size);
+	format->us_per_frame        = USECONDS / format->sample_rate;
+	format->frames_per_us       = format->sample_rate / USECONDS;
+	format->us_per_sample       = format->us_per_frame / options->channels;
+	format->gap_fade_frames     = (unsigned long)lround(GAP_FADE_US * format->frames_per_us);
+	format->conceal_fade_frames = (unsigned long)lround(CONCEAL_FADE_US * format->frames_per_us);
+}
+
+// (re)allocates the ring buffer to fit options.buffer_ms & the jitter
+// buffer's chunks, both sized for the options' sample format, dropping
+// anything in them. Only safe while the stream is closed.
+static bool allocate_audio_buffer(audio_callback_context *context)
+{
+	ring_buffer_size_t chunks = buffer_chunks(context->options.buffer_ms);
+	size_t previous_bytes     = context->format.packet_bytes;
+
+	stream_format_init(&context->format, &context->options);
+
+	size_t bytes = context->format.packet_bytes;
+
+	if (context->jitter_chunks == NULL || bytes != previous_bytes) {
+		timestamped_packet *staging = driver_alloc(bytes * JITTER_SLOTS);
+
+		if (staging == NULL) { return false; }
+
+		if (context->jitter_chunks != NULL) {
+			driver_free((char*)context->jitter_chunks);
+		}
+		context->jitter_chunks = staging;
+	}
+
+	if (context->audio_buffer_data == NULL || chunks != context->buffer_chunks || bytes != previous_bytes) {
+		timestamped_packet *data = driver_alloc(bytes * chunks);
+
+		if (data == NULL) { return false; }
+
+		if (context->audio_buffer_data != NULL) {
+			driver_free((char*)context->audio_buffer_data);
+		}
+		context->audio_buffer_data = data;
+		context->buffer_chunks     = chunks;
+	}
+
+	memset(context->audio_buffer_data, 0, bytes * context->buffer_chunks);
+	PaUtil_InitializeRingBuffer(&context->audio_buffer, bytes, context->buffer_chunks, context->audio_buffer_data);
+
+	printf("\rDRV: ring buffer %ld x %lu frame chunks, %.0fms in %zu bytes\r\n",
+			(long)context->buffer_chunks,
+			context->format.chunk_frames,
+			context->buffer_chunks * CHUNK_MS,
+			bytes * context->buffer_chunks);
+	return true;
+}
+
 static ErlDrvData portaudio_drv_start(ErlDrvPort port, char *buff)
 {
 	PaError             err;
 
-	UNUSED(buff);
-
 	portaudio_state* state          = driver_alloc(sizeof(portaudio_state));
 	audio_callback_context* context = driver_alloc(sizeof(audio_callback_context));
-	context->active_packet          = driver_alloc(sizeof(timestamped_packet));
-	context->audio_buffer_data      = driver_alloc(sizeof(timestamped_packet) * PACKET_BUFFER_SIZE);
 
-	if (context->audio_buffer_data == NULL) {
+	state->sntp.fd = -1;
+
+	driver_options_init(&context->options);
+	driver_options_parse(&context->options, buff);
+
+	// big enough for a chunk in any format, so it never has to change
+	context->active_packet          = driver_alloc(packet_bytes(MAX_CHUNK_SIZE));
+	context->audio_stream           = NULL;
+	context->audio_buffer_data      = NULL;
+	context->jitter_chunks          = NULL;
+	context->format.packet_bytes    = 0;
+
+	if (!allocate_audio_buffer(context)) {
 		printf("\rDRV ERROR: problem allocating buffer\r\n");
 		goto error;
 	}
 
-	memset(context->audio_buffer_data, 0, sizeof(timestamped_packet) * PACKET_BUFFER_SIZE);
-
 	context->timestamp_offset_stats = driver_alloc(sizeof(stream_statistics_t));
 
-	pid_init(&context->pid, PID_P, PID_I, PID_D, PID_DI_CUTOFF);
-
 	stream_stats_init(context->timestamp_offset_stats, 0.0001);
 
 	context->active_packet->timestamp = 0;
@@ -386,8 +1172,52 @@ static ErlDrvData portaudio_drv_start(ErlDrvPort port, char *buff)
 	// This initial setting has to mirror the initial state in
 	// Otis.Receivers.ControlConnection.initial_settings/0
 	context->volume                   = 0.0f;
-
-	PaUtil_InitializeRingBuffer(&context->audio_buffer, sizeof(timestamped_packet), PACKET_BUFFER_SIZE, context->audio_buffer_data);
+	context->kernels                  = sample_kernels();
+	context->passthrough              = false;
+	context->slip                     = 0.0;
+	context->resampler_lag            = 0.0;
+	context->resampler_quality        = context->options.resampler_quality;
+	context->resampler_ceiling        = context->options.resampler_quality;
+	context->load_frames              = 0;
+	context->output_time              = 0;
+	context->waiting                  = false;
+	context->concealing               = false;
+
+	clock_map_init(&context->clock_map);
+	memset(&context->mapping, 0, sizeof(context->mapping));
+
+	context->port_term                = driver_mk_port(port);
+	context->atom_audio_buffer        = driver_mk_atom("audio_buffer");
+	context->atom_high_watermark      = driver_mk_atom("high_watermark");
+	context->atom_low_watermark       = driver_mk_atom("low_watermark");
+	context->atom_overflow            = driver_mk_atom("overflow");
+	context->above_high_watermark     = false;
+	context->rejected_chunks          = 0;
+	context->evict_requested          = 0;
+	context->evicted                  = 0;
+	context->duplicate_chunks         = 0;
+	context->late_chunks              = 0;
+	context->gap_chunks               = 0;
+	context->jitter_lock              = erl_drv_mutex_create("janis_jitter");
+
+	jitter_buffer_init(&context->jitter, JITTER_TOLERANCE_US);
+	memset(context->last_committed, 0, sizeof(context->last_committed));
+
+	log_ring_init(&context->log);
+	audio_thread_init(&context->audio_thread);
+
+	metrics_init(&context->metrics);
+
+	memset(context->last_frame, 0, sizeof(context->last_frame));
+
+	printf("\rDRV: using %s sample kernels\r\n", context->kernels->name);
+
+	if (start_housekeeping(context) != 0) {
+		// we'll still play, just without the audio thread's log or its
+		// realtime scheduling
+		context->housekeeping_running = false;
+		printf("!! Error starting housekeeping thread\r\n");
+	}
 
 	err = initialize_audio_stream(context);
 
@@ -396,18 +1226,15 @@ static ErlDrvData portaudio_drv_start(ErlDrvPort port, char *buff)
 	printf("\rDRV: driver start\r\n");
 	state->port = port;
 	state->audio_context = context;
+	state->atom_sntp = driver_mk_atom("sntp");
 
-	int src_error = 0;
-
-	// SRC_SINC_FASTEST
-	// SRC_SINC_MEDIUM_QUALITY
-	// SRC_SINC_BEST_QUALITY
-	context->resampler = src_callback_new(src_input_callback, SRC_SINC_MEDIUM_QUALITY, CHANNEL_COUNT, &src_error, context);
+	int src_error = resampler_init(&context->resampler, context->options.resampler_quality, context->format.channels, src_input_callback, context);
 
-	if (context->resampler == NULL && (src_error != 0)) {
+	if (src_error != 0) {
 		printf("!! Error initializing resampler %d\r\n", src_error);
 		goto error;
 	}
+	printf("\rDRV: resampler quality %s%s\r\n", resampler_quality_name(context->options.resampler_quality), context->options.resampler_adaptive ? " (adaptive)" : "");
 
 	return (ErlDrvData)state;
 
@@ -418,31 +1245,122 @@ error:
 
 void stop_audio(audio_callback_context *context) {
 	printf("\rDRV: stop audio\r\n");
-	PaError err;
-	err = Pa_AbortStream(context->audio_stream);
-	if (err != paNoError) { goto error; }
-	err = Pa_CloseStream(context->audio_stream);
-	if (err != paNoError) { goto error; }
+	PaError err = close_audio_stream(context);
 	Pa_Terminate();
-	return;
+	if (err != paNoError) {
+		fprintf( stderr, "\rAn error occured while stopping the portaudio stream\r\n" );
+		fprintf( stderr, "\rError number: %d\r\n", err );
+		fprintf( stderr, "\rError message: %s\r\n", Pa_GetErrorText( err ) );
+	}
+}
 
-error:
-	Pa_Terminate();
-	fprintf( stderr, "\rAn error occured while stopping the portaudio stream\r\n" );
-	fprintf( stderr, "\rError number: %d\r\n", err );
-	fprintf( stderr, "\rError message: %s\r\n", Pa_GetErrorText( err ) );
-	return;
+// the resampler's converters are made for a number of channels, so a change
+// of format may need new ones
+static bool resize_resampler(audio_callback_context *context)
+{
+	if (context->resampler.channels == context->format.channels) { return true; }
+
+	resampler_free(&context->resampler);
+	return resampler_init(&context->resampler, context->resampler_quality, context->format.channels, src_input_callback, context) == 0;
+}
+
+// Sizes the buffers & resampler for the current options & starts playback
+// over. Returns false if they couldn't be allocated, leaving the playback
+// state alone. Only safe while the stream & housekeeping are stopped.
+static bool prepare_audio_stream(audio_callback_context *context)
+{
+	bool allocated = allocate_audio_buffer(context) && resize_resampler(context);
+
+	// the staging slots may have moved even if something else failed
+	reset_jitter_buffer(context);
+
+	if (!allocated) { return false; }
+
+	context->active_packet->len    = 0;
+	context->active_packet->offset = 0;
+	context->above_high_watermark  = false;
+	context->evicted               = context->evict_requested;
+	context->resampler_quality     = context->options.resampler_quality;
+	context->resampler_ceiling     = context->options.resampler_quality;
+	context->load_frames           = 0;
+	playback_stopped(context);
+	set_resampler_quality(context, context->resampler_quality);
+	audio_thread_init(&context->audio_thread);
+	return true;
+}
+
+// Closes the stream & opens it again with `options`, starting playback
+// over with an empty ring buffer. If the new stream can't be opened, or
+// its buffers allocated, we go back to the old options. Called from the
+// control thread, which is the only thing touching the audio thread's
+// state while the stream is closed.
+static PaError reconfigure_audio_stream(audio_callback_context *context, const driver_options_t *options)
+{
+	driver_options_t previous = context->options;
+	PaError err;
+
+	printf("\rDRV: reconfigure\r\n");
+
+	err = close_audio_stream(context);
+	if (err != paNoError) { return err; }
+
+	// the new stream gets a new audio thread, which housekeeping has to
+	// find & configure again
+	if (context->housekeeping_running) {
+		stop_housekeeping(context);
+	}
+
+	context->options = *options;
+
+	err = prepare_audio_stream(context) ? paNoError : paInsufficientMemory;
+
+	if (err == paNoError) {
+		err = open_audio_stream(context);
+		if (err != paNoError) { print_pa_error(err); }
+	}
+
+	if (err != paNoError) {
+		context->options = previous;
+
+		if (!prepare_audio_stream(context)) {
+			// The ring buffer may not fit the format, so take no audio until
+			// a configure gets a stream going again. Housekeeping stays
+			// stopped as there's no audio thread for it to look after & no
+			// chunks to commit; the next configure or stop copes with that.
+			printf("!! Error reallocating the previous buffers, no stream\r\n");
+			context->stopped = true;
+			return err;
+		}
+		if (open_audio_stream(context) != paNoError) {
+			printf("!! Error reopening the previous stream\r\n");
+		}
+	}
+
+	if (start_housekeeping(context) != 0) {
+		context->housekeeping_running = false;
+		printf("!! Error starting housekeeping thread\r\n");
+	}
+	return err;
 }
 
 static void portaudio_drv_stop(ErlDrvData drv_data) {
 	portaudio_state *state = (portaudio_state*)drv_data;
 	audio_callback_context *context = state->audio_context;
+	if (state->sntp.fd >= 0) {
+		// the VM closes it in stop_select once it's done with it
+		driver_select(state->port, (ErlDrvEvent)(intptr_t)state->sntp.fd, ERL_DRV_USE, 0);
+	}
 	stop_audio(context);
+	if (context->housekeeping_running) {
+		stop_housekeeping(context);
+	}
 	printf("\rDRV: free\r\n");
 
-	src_delete(context->resampler);
+	resampler_free(&context->resampler);
 
 	driver_free((char*)context->timestamp_offset_stats);
+	erl_drv_mutex_destroy(context->jitter_lock);
+	driver_free((char*)context->jitter_chunks);
 	driver_free((char*)context->audio_buffer_data);
 	driver_free((char*)context->active_packet);
 	driver_free((char*)context);
@@ -457,54 +1375,530 @@ static void encode_response(char *rbuf, int *index, long buffer_size) {
 	ei_encode_long(rbuf, index, buffer_size);
 }
 
-// based on src_short_to_float_array https://github.com/erikd/libsamplerate/blob/master/src/samplerate.c
-static inline void short_to_float_array(const short *in, float *out, int len)
+// returns the next free slot in the ring buffer without copying anything
+// into it. The slot isn't visible to the audio thread until it's committed
+// with PaUtil_AdvanceRingBufferWriteIndex
+static timestamped_packet *reserve_packet(audio_callback_context *context)
+{
+	void *region1, *region2;
+	ring_buffer_size_t size1, size2;
+
+	if (PaUtil_GetRingBufferWriteRegions(&context->audio_buffer, 1, &region1, &size1, &region2, &size2) == 0) {
+		return NULL;
+	}
+	return (timestamped_packet*)region1;
+}
+
+// with overflow=evict, asks the audio thread to drop the oldest chunks
+// once the free space, counting the chunks it's already been asked to drop,
+// falls below the headroom
+static void make_room(audio_callback_context *context)
+{
+	ring_buffer_size_t headroom = MIN(EVICT_HEADROOM_CHUNKS, context->buffer_chunks / 2);
+	uint32_t pending = context->evict_requested - context->evicted;
+	ring_buffer_size_t available = PaUtil_GetRingBufferWriteAvailable(&context->audio_buffer) + (ring_buffer_size_t)pending;
+
+	if (available < headroom) {
+		context->evict_requested += (uint32_t)(headroom - available);
+	}
+}
+
+// the time now on the broadcaster's clock, which the audio's timestamps are
+// on. For the control & housekeeping threads.
+static uint64_t broadcaster_now(audio_callback_context *context)
+{
+	clock_mapping_t mapping;
+	clock_map_read(&context->clock_map, &mapping);
+	return clock_map_to_broadcaster(&mapping, monotonic_microseconds());
+}
+
+// mirrors Janis.Audio.PortAudio.calculate_timestamp/2, `bytes` being of the
+// audio as it comes in
+static inline uint64_t next_packet_timestamp(audio_callback_context *context, uint64_t timestamp, size_t bytes)
+{
+	const size_t frame_bytes = context->format.frame_bytes;
+	size_t frames = (bytes + frame_bytes - 1) / frame_bytes;
+	return (uint64_t)llround((double)timestamp + ((double)frames * context->format.us_per_frame));
+}
+
+// the jitter buffer's staging slot, whose size depends on the format
+static inline timestamped_packet *jitter_chunk(audio_callback_context *context, int slot)
+{
+	return (timestamped_packet*)((char*)context->jitter_chunks + (size_t)slot * context->format.packet_bytes);
+}
+
+// fills `gap_us` from `timestamp` with silence, faded out from the last
+// frame committed. The caller has checked there's room.
+static void fill_gap(audio_callback_context *context, uint64_t timestamp, uint64_t gap_us)
+{
+	int  channels = context->format.channels;
+	long fade     = (long)context->format.gap_fade_frames;
+	long frames   = lround((double)gap_us * context->format.frames_per_us);
+	long faded    = 0;
+
+	while (frames > 0) {
+		timestamped_packet *packet = reserve_packet(context);
+		long n = MIN(frames, (long)context->format.chunk_frames);
+
+		packet->timestamp = timestamp;
+		packet->offset    = 0;
+		packet->len       = (uint16_t)(n * channels);
+
+		memset(packet->data, 0, packet->len * sizeof(float));
+		for (long f = 0; f < n && faded < fade; f++, faded++) {
+			float gain = 1.0f - (float)(faded + 1) / fade;
+			for (int c = 0; c < channels; c++) {
+				packet->data[f * channels + c] = context->last_committed[c] * gain;
+			}
+		}
+		PaUtil_AdvanceRingBufferWriteIndex(&context->audio_buffer, 1);
+
+		timestamp = next_packet_timestamp(context, timestamp, n * context->format.frame_bytes);
+		frames   -= n;
+		context->gap_chunks++;
+	}
+	memset(context->last_committed, 0, sizeof(context->last_committed));
+}
+
+// moves the oldest chunk in the jitter buffer into the ring buffer, after
+// filling any gap between it & the last one. Returns false if there wasn't
+// room. Called with the jitter lock held.
+static bool commit_oldest(audio_callback_context *context)
+{
+	const jitter_entry_t *entry = jitter_buffer_peek(&context->jitter);
+	uint64_t gap = jitter_buffer_gap(&context->jitter);
+	ring_buffer_size_t gap_fill = 0;
+
+	if (entry == NULL) { return false; }
+
+	if (gap > 0 && gap <= context->options.max_gap_ms * 1000) {
+		gap_fill = (ring_buffer_size_t)ceil(gap * context->format.frames_per_us / context->format.chunk_frames);
+	}
+
+	if (context->options.overflow == OVERFLOW_EVICT) {
+		make_room(context);
+	}
+
+	if (PaUtil_GetRingBufferWriteAvailable(&context->audio_buffer) < gap_fill + 1) {
+		return false;
+	}
+
+	if (gap_fill > 0) {
+		fill_gap(context, context->jitter.next_timestamp, gap);
+	}
+
+	timestamped_packet *packet = reserve_packet(context);
+
+	int channels = context->format.channels;
+
+	memcpy(packet, jitter_chunk(context, entry->slot), context->format.packet_bytes);
+	if (gap > 0) {
+		fade_in(context, packet);
+	}
+	if (packet->len >= channels) {
+		memcpy(context->last_committed, &packet->data[packet->len - channels], channels * sizeof(float));
+	}
+
+	PaUtil_AdvanceRingBufferWriteIndex(&context->audio_buffer, 1);
+	jitter_buffer_commit(&context->jitter);
+	return true;
+}
+
+// commits the chunks that are nearly due or have been overtaken by the
+// reorder window. Called with the jitter lock held.
+static void commit_chunks(audio_callback_context *context)
+{
+	uint64_t due    = broadcaster_now(context) + JITTER_COMMIT_LEAD_US;
+	uint64_t window = (uint64_t)(context->options.reorder_ms * 1000);
+	const jitter_entry_t *entry;
+
+	while ((entry = jitter_buffer_peek(&context->jitter)) != NULL) {
+		if (entry->timestamp > due && jitter_buffer_span(&context->jitter) < window) { break; }
+		if (!commit_oldest(context)) { break; }
+	}
+}
+
+static void commit_jitter_buffer(audio_callback_context *context)
+{
+	erl_drv_mutex_lock(context->jitter_lock);
+	commit_chunks(context);
+	erl_drv_mutex_unlock(context->jitter_lock);
+}
+
+static void reset_jitter_buffer(audio_callback_context *context)
+{
+	erl_drv_mutex_lock(context->jitter_lock);
+	jitter_buffer_reset(&context->jitter);
+	erl_drv_mutex_unlock(context->jitter_lock);
+}
+
+// converts `samples` of the incoming audio to float
+static void convert_input(audio_callback_context *context, const void *in, float *out, size_t samples)
+{
+	switch (context->format.sample_bits) {
+		case 16:
+			context->kernels->s16_to_float((const int16_t*)in, out, samples, 1.0f);
+			break;
+		case 24:
+			context->kernels->s24_to_float((const uint8_t*)in, out, samples, 1.0f);
+			break;
+		case 32:
+			context->kernels->s32_to_float((const int32_t*)in, out, samples, 1.0f);
+			break;
+	}
+}
+
+// consumes `bytes` (at most a chunk) of audio from the reader into the
+// jitter buffer. Duplicates & chunks that are already in the past are
+// dropped. Returns false if there was no room for it.
+static bool stage_chunk(audio_callback_context *context, uint64_t timestamp, packet_reader_t *reader, size_t bytes)
+{
+	// only whole frames
+	size_t samples = (bytes / context->format.frame_bytes) * context->format.channels;
+	uint64_t end   = next_packet_timestamp(context, timestamp, bytes);
+	bool queued    = true;
+	size_t staged  = 0;
+
+	if (samples == 0) {
+		packet_reader_skip(reader, bytes);
+		return true;
+	}
+
+	if (end <= broadcaster_now(context)) {
+		packet_reader_skip(reader, bytes);
+		context->late_chunks++;
+		return true;
+	}
+
+	erl_drv_mutex_lock(context->jitter_lock);
+
+	int slot = jitter_buffer_insert(&context->jitter, timestamp, end);
+
+	if (slot == JITTER_FULL && commit_oldest(context)) {
+		slot = jitter_buffer_insert(&context->jitter, timestamp, end);
+	}
+
+	if (slot >= 0) {
+		timestamped_packet *packet = jitter_chunk(context, slot);
+
+		packet->timestamp = timestamp;
+		packet->offset    = 0;
+		packet->len       = (uint16_t)packet_reader_read_samples(reader, context->staging, samples, context->format.sample_bytes);
+		convert_input(context, context->staging, packet->data, packet->len);
+
+		// the slot's the audio thread's once we let go of the lock
+		staged = packet->len;
+
+		commit_chunks(context);
+	} else if (slot == JITTER_DUPLICATE) {
+		context->duplicate_chunks++;
+	} else if (slot == JITTER_LATE) {
+		context->late_chunks++;
+	} else {
+		context->rejected_chunks++;
+		queued = false;
+	}
+
+	erl_drv_mutex_unlock(context->jitter_lock);
+
+	packet_reader_skip(reader, bytes - staged * context->format.sample_bytes);
+	return queued;
+}
+
+
+// splits `bytes` of audio starting at `timestamp` into chunks. The last
+// chunk holds whatever's left over, there's no padding. Returns the number
+// of chunks there wasn't room for.
+static long enqueue_audio(audio_callback_context *context, uint64_t timestamp, packet_reader_t *reader, size_t bytes)
+{
+	long rejected = 0;
+
+	while (bytes > 0) {
+		size_t chunk = MIN(bytes, context->format.chunk_frames * context->format.frame_bytes);
+
+		if (!stage_chunk(context, timestamp, reader, chunk)) {
+			rejected++;
+		}
+
+		timestamp = next_packet_timestamp(context, timestamp, chunk);
+		bytes    -= chunk;
+	}
+	return rejected;
+}
+
+// reader holds one or more concatenated <<timestamp:64, len:16, data:len>>
+// records
+static long play_records(audio_callback_context *context, packet_reader_t *reader)
+{
+	char header[PACKET_HEADER_SIZE];
+	long rejected = 0;
+
+	while (packet_reader_read(reader, header, PACKET_HEADER_SIZE) == PACKET_HEADER_SIZE) {
+		uint64_t time   = le64toh(*(uint64_t *) header);
+		uint16_t length = le16toh(*(uint16_t *) (header + 8));
+
+		if (length > reader->remaining) { break; }
+
+		rejected += enqueue_audio(context, time, reader, length);
+	}
+	return rejected;
+}
+
+// reader holds a complete <<timestamp:64, data>> packet as sent by the
+// broadcaster
+static long play_packet(audio_callback_context *context, packet_reader_t *reader)
+{
+	uint64_t time;
+
+	if (packet_reader_read(reader, &time, sizeof(uint64_t)) < sizeof(uint64_t)) { return 0; }
+
+	return enqueue_audio(context, le64toh(time), reader, reader->remaining);
+}
+
+// Called with the iolist given to Port.command/2, which for audio data is
+// [<<timestamp:64>>, data]. Large binaries arrive here as references to the
+// original refc binary from the data socket, so the audio is only copied
+// once, into the ring buffer.
+static void portaudio_drv_outputv(ErlDrvData drv_data, ErlIOVec *ev)
 {
-	while (len) {
-		len--;
-		out[len] = (float) ((in[len]) / (1.0 * 0x8000)) ;
+	portaudio_state *state = (portaudio_state*)drv_data;
+	audio_callback_context *context = state->audio_context;
+	packet_reader_t reader;
+
+	if (context->stopped) { return; }
+
+	packet_reader_init_iov(&reader, ev);
+
+	long rejected = play_packet(context, &reader);
+
+	if (rejected > 0) {
+		send_buffer_event(context, context->atom_overflow, rejected);
+	}
+}
+
+static void encode_errno(char *buf, int *index, int error) {
+	ei_encode_atom(buf, index, error == 0 ? "ok" : erl_errno_id(error));
+}
+
+// how audio_thread_configure got on, `undefined` until it has run
+static void encode_audio_thread(char *buf, int *index, audio_callback_context *context) {
+	audio_thread_t *audio_thread = &context->audio_thread;
+
+	if (!audio_thread->reported) {
+		ei_encode_atom(buf, index, "undefined");
+		return;
+	}
+
+	ei_encode_map_header(buf, index, 7);
+	ei_encode_atom(buf, index, "tid");
+	ei_encode_long(buf, index, audio_thread->tid);
+	ei_encode_atom(buf, index, "cpu");
+	if (audio_thread->cpu >= 0) {
+		ei_encode_long(buf, index, audio_thread->cpu);
+	} else {
+		ei_encode_atom(buf, index, "none");
+	}
+	ei_encode_atom(buf, index, "policy");
+	ei_encode_atom(buf, index, audio_thread_policy_name(context->options.audio_thread.policy));
+	ei_encode_atom(buf, index, "priority");
+	ei_encode_long(buf, index, audio_thread->priority);
+	ei_encode_atom(buf, index, "affinity");
+	encode_errno(buf, index, audio_thread->affinity_error);
+	ei_encode_atom(buf, index, "scheduling");
+	encode_errno(buf, index, audio_thread->sched_error);
+	ei_encode_atom(buf, index, "isolated_threads");
+	ei_encode_long(buf, index, audio_thread->isolated_threads);
+}
+
+static void encode_stats(char *buf, int *index, audio_callback_context *context, const metrics_t *metrics) {
+	clock_mapping_t mapping;
+	clock_map_read(&context->clock_map, &mapping);
+
+	ei_encode_map_header(buf, index, 20);
+
+	ei_encode_atom(buf, index, "callbacks");
+	ei_encode_ulonglong(buf, index, metrics->callbacks);
+	ei_encode_atom(buf, index, "underruns");
+	ei_encode_ulonglong(buf, index, metrics->underruns);
+	// the device running dry since the stream was opened, for the backends
+	// that don't go through PortAudio
+	ei_encode_atom(buf, index, "xruns");
+	ei_encode_ulong(buf, index, (context->options.backend != OUTPUT_BACKEND_PORTAUDIO) ? context->pcm_output.xruns : 0);
+	ei_encode_atom(buf, index, "late_packets");
+	ei_encode_ulonglong(buf, index, metrics->late_packets);
+	// chunks there was no room for & chunks dropped to make room
+	ei_encode_atom(buf, index, "rejected_chunks");
+	ei_encode_ulonglong(buf, index, context->rejected_chunks);
+	ei_encode_atom(buf, index, "evicted_chunks");
+	ei_encode_ulong(buf, index, context->evicted);
+
+	// chunks waiting to be put in order, duplicates & chunks that arrived too
+	// late that were dropped & chunks of silence put in to fill gaps
+	ei_encode_atom(buf, index, "jitter_buffer");
+	ei_encode_map_header(buf, index, 4);
+	ei_encode_atom(buf, index, "staged");
+	ei_encode_long(buf, index, context->jitter.count);
+	ei_encode_atom(buf, index, "duplicate_chunks");
+	ei_encode_ulonglong(buf, index, context->duplicate_chunks);
+	ei_encode_atom(buf, index, "late_chunks");
+	ei_encode_ulonglong(buf, index, context->late_chunks);
+	ei_encode_atom(buf, index, "gap_chunks");
+	ei_encode_ulonglong(buf, index, context->gap_chunks);
+	ei_encode_atom(buf, index, "playing");
+	ei_encode_boolean(buf, index, metrics->playing);
+	ei_encode_atom(buf, index, "passthrough");
+	ei_encode_boolean(buf, index, metrics->passthrough);
+	// runs of missing audio covered up without restarting playback
+	ei_encode_atom(buf, index, "concealment");
+	ei_encode_map_header(buf, index, 2);
+	ei_encode_atom(buf, index, "gaps");
+	ei_encode_ulonglong(buf, index, metrics->concealments);
+	ei_encode_atom(buf, index, "concealed_ms");
+	ei_encode_double(buf, index, metrics->concealed_frames * 1000.0 / context->format.sample_rate);
+	// the mapping onto the broadcaster's clock
+	ei_encode_atom(buf, index, "clock_delta_us");
+	ei_encode_longlong(buf, index, mapping.delta);
+	ei_encode_atom(buf, index, "clock_skew_ppm");
+	ei_encode_double(buf, index, mapping.slew * 1e6);
+	ei_encode_atom(buf, index, "resampler_quality");
+	ei_encode_atom(buf, index, resampler_quality_name(metrics->resampler_quality));
+	ei_encode_atom(buf, index, "resample_ratio");
+	ei_encode_double(buf, index, metrics->resample_ratio);
+	ei_encode_atom(buf, index, "cpu_load");
+	ei_encode_double(buf, index, metrics->cpu_load);
+
+	ei_encode_atom(buf, index, "offset_us");
+	ei_encode_map_header(buf, index, 5);
+	ei_encode_atom(buf, index, "last");
+	ei_encode_longlong(buf, index, metrics->offset_us);
+	ei_encode_atom(buf, index, "smoothed");
+	ei_encode_double(buf, index, metrics->smoothed_offset_us);
+	ei_encode_atom(buf, index, "p1");
+	ei_encode_longlong(buf, index, metrics_offset_percentile(metrics, 0.01));
+	ei_encode_atom(buf, index, "p50");
+	ei_encode_longlong(buf, index, metrics_offset_percentile(metrics, 0.5));
+	ei_encode_atom(buf, index, "p99");
+	ei_encode_longlong(buf, index, metrics_offset_percentile(metrics, 0.99));
+
+	ei_encode_atom(buf, index, "pid");
+	ei_encode_map_header(buf, index, 7);
+	ei_encode_atom(buf, index, "p");
+	ei_encode_double(buf, index, metrics->pid_p);
+	ei_encode_atom(buf, index, "i");
+	ei_encode_double(buf, index, metrics->pid_i);
+	ei_encode_atom(buf, index, "d");
+	ei_encode_double(buf, index, metrics->pid_d);
+	ei_encode_atom(buf, index, "ff");
+	ei_encode_double(buf, index, metrics->pid_ff);
+	ei_encode_atom(buf, index, "kp");
+	ei_encode_double(buf, index, metrics->pid_kp);
+	ei_encode_atom(buf, index, "ki");
+	ei_encode_double(buf, index, metrics->pid_ki);
+	ei_encode_atom(buf, index, "kd");
+	ei_encode_double(buf, index, metrics->pid_kd);
+
+	// the percentiles are the upper bounds of power of 2 buckets
+	ei_encode_atom(buf, index, "callback_ns");
+	ei_encode_map_header(buf, index, 4);
+	ei_encode_atom(buf, index, "last");
+	ei_encode_ulonglong(buf, index, metrics->callback_ns);
+	ei_encode_atom(buf, index, "p50");
+	ei_encode_ulonglong(buf, index, metrics_duration_percentile(metrics, 0.5));
+	ei_encode_atom(buf, index, "p99");
+	ei_encode_ulonglong(buf, index, metrics_duration_percentile(metrics, 0.99));
+	ei_encode_atom(buf, index, "max");
+	ei_encode_ulonglong(buf, index, metrics->callback_ns_max);
+
+	// callbacks seen with 0-19, 20-39... ms of audio in the ring buffer, up
+	// to its capacity
+	int fill_buckets = MIN((int)(context->buffer_chunks * CHUNK_MS) / METRICS_FILL_BUCKET_MS + 1, METRICS_FILL_BUCKETS);
+
+	ei_encode_atom(buf, index, "buffer_fill");
+	ei_encode_list_header(buf, index, fill_buckets);
+	for (int i = 0; i < fill_buckets; i++) {
+		ei_encode_ulong(buf, index, metrics->fill[i]);
 	}
+	ei_encode_empty_list(buf, index);
+
+	ei_encode_atom(buf, index, "audio_thread");
+	encode_audio_thread(buf, index, context);
+}
+
+// the stream as it's been opened
+static void encode_configuration(char *buf, int *index, audio_callback_context *context) {
+	ei_encode_map_header(buf, index, 9);
+	ei_encode_atom(buf, index, "sample_rate");
+	ei_encode_ulong(buf, index, context->options.sample_rate);
+	ei_encode_atom(buf, index, "sample_bits");
+	ei_encode_long(buf, index, context->format.sample_bits);
+	ei_encode_atom(buf, index, "channels");
+	ei_encode_long(buf, index, context->format.channels);
+	ei_encode_atom(buf, index, "backend");
+	ei_encode_atom(buf, index, driver_options_backend_name(context->options.backend));
+	ei_encode_atom(buf, index, "buffer_ms");
+	ei_encode_double(buf, index, context->buffer_chunks * CHUNK_MS);
+	ei_encode_atom(buf, index, "frames_per_buffer");
+	ei_encode_ulong(buf, index, context->options.frames_per_buffer);
+	ei_encode_atom(buf, index, "output_format");
+	ei_encode_atom(buf, index, driver_options_format_name(context->options.output_format));
+	ei_encode_atom(buf, index, "requested_latency_ms");
+	ei_encode_double(buf, index, context->latency * 1000.0);
+	ei_encode_atom(buf, index, "latency_ms");
+	ei_encode_double(buf, index, context->granted_latency * 1000.0);
+}
 
-	return;
+// makes sure *rbuf has room for `size` bytes, allocating a new one (which the
+// emulator frees) if the default buffer is too small. Returns the index to
+// carry on encoding from.
+static int reserve_reply(char **rbuf, ErlDrvSizeT rlen, int index, int size) {
+	if ((ErlDrvSizeT)size > rlen) {
+		*rbuf = driver_alloc(size);
+		index = 0;
+		ei_encode_version(*rbuf, &index);
+	}
+	return index;
 }
 
 static ErlDrvSSizeT portaudio_drv_control(
 		ErlDrvData   drv_data,
 		unsigned int cmd,
 		char         *buf,
-		ErlDrvSizeT  _len,
+		ErlDrvSizeT  len,
 		char         **rbuf,
-		ErlDrvSizeT  _rlen)
+		ErlDrvSizeT  rlen)
 {
 
 	int index = 0;
 	ei_encode_version(*rbuf, &index);
 
-	UNUSED(_len);
-	UNUSED(_rlen);
-
 	portaudio_state *state = (portaudio_state*)drv_data;
 	audio_callback_context *context = state->audio_context;
 
-	if (cmd == PLAY_COMMAND) {
-		if (!context->stopped) {
-			uint64_t time = le64toh(*(uint64_t *) buf);
-			uint16_t len  = le16toh(*(uint16_t *) (buf + 8));
-			struct timestamped_packet packet = {
-				.offset = 0,
-				.timestamp = time,
-				.len = len / 2
-			};
+	if (cmd == PLAY_COMMAND || cmd == PLAY_PACKET_COMMAND) {
+		long rejected = 0;
 
-			// conversion to float needed by libsamplerate
-			short_to_float_array((short*)(buf + 10), packet.data, packet.len);
+		if (!context->stopped) {
+			packet_reader_t reader;
+			packet_reader_init_buf(&reader, buf, len);
 
-			PaUtil_WriteRingBuffer(&context->audio_buffer, &packet, 1);
+			if (cmd == PLAY_COMMAND) {
+				rejected = play_records(context, &reader);
+			} else {
+				rejected = play_packet(context, &reader);
+			}
 		}
 
 		long buffer_size = PaUtil_GetRingBufferReadAvailable(&context->audio_buffer);
 
-		encode_response(*rbuf, &index, buffer_size);
+		if (rejected > 0) {
+			// {overflow, RejectedChunks, BufferSize}
+			ei_encode_tuple_header(*rbuf, &index, 3);
+			ei_encode_atom(*rbuf, &index, "overflow");
+			ei_encode_long(*rbuf, &index, rejected);
+			ei_encode_long(*rbuf, &index, buffer_size);
+		} else {
+			encode_response(*rbuf, &index, buffer_size);
+		}
 	} else if (cmd == TIME_COMMAND) {
 		uint64_t t = monotonic_microseconds();
 		ei_encode_tuple_header(*rbuf, &index, 2);
@@ -518,26 +1912,203 @@ static ErlDrvSSizeT portaudio_drv_control(
 		float volume = *((float *)buf);
 		context->volume = MAX(MIN(volume, 1.0), 0.0);
 		ei_encode_atom(*rbuf, &index, "ok");
+	} else if (cmd == DELTA_COMMAND) {
+		// the time delta in µs as a native 64 bit int, the local time in µs
+		// it was measured at as a native 64 bit unsigned int & the clock
+		// skew as a native double
+		clock_mapping_t mapping;
+
+		if (len != 24) {
+			ei_encode_tuple_header(*rbuf, &index, 2);
+			ei_encode_atom(*rbuf, &index, "error");
+			ei_encode_atom(*rbuf, &index, "badarg");
+			return (ErlDrvSSizeT)index;
+		}
+		memcpy(&mapping.delta, buf, 8);
+		memcpy(&mapping.since, buf + 8, 8);
+		memcpy(&mapping.slew, buf + 16, 8);
+		mapping.slew = MAX(MIN(mapping.slew, MAX_CLOCK_SLEW), -MAX_CLOCK_SLEW);
+
+		clock_map_set(&context->clock_map, &mapping);
+		ei_encode_atom(*rbuf, &index, "ok");
+	} else if (cmd == RESAMPLER_COMMAND) {
+		// an empty buf just asks for the current settings
+		char name[16];
+		resampler_quality_t quality;
+
+		if (len > 0) {
+			size_t n = MIN(len, sizeof(name) - 1);
+			memcpy(name, buf, n);
+			name[n] = '\0';
+
+			if (!resampler_quality_parse(name, &quality)) {
+				ei_encode_tuple_header(*rbuf, &index, 2);
+				ei_encode_atom(*rbuf, &index, "error");
+				ei_encode_atom(*rbuf, &index, "invalid_quality");
+				return (ErlDrvSSizeT)index;
+			}
+			// picked up by the audio thread in adapt_resampler_quality
+			context->resampler_quality = quality;
+		}
+		ei_encode_tuple_header(*rbuf, &index, 3);
+		ei_encode_atom(*rbuf, &index, "ok");
+		ei_encode_atom(*rbuf, &index, resampler_quality_name(context->resampler_quality));
+		ei_encode_atom(*rbuf, &index, resampler_quality_name(context->resampler.quality));
+	} else if (cmd == STATS_COMMAND) {
+		metrics_t metrics;
+		metrics_read(&context->metrics, &metrics);
+
+		// a non-zero byte asks for the metrics to start again once read
+		if (len > 0 && buf[0] != 0) {
+			metrics_request_reset(&context->metrics);
+		}
+
+		// the reply is too big for the default buffer so work out its size
+		// (ei skips the writes given a NULL buffer) & allocate one that fits.
+		int size = index;
+		ei_encode_tuple_header(NULL, &size, 2);
+		ei_encode_atom(NULL, &size, "ok");
+		encode_stats(NULL, &size, context, &metrics);
+
+		index = reserve_reply(rbuf, rlen, index, size);
+		ei_encode_tuple_header(*rbuf, &index, 2);
+		ei_encode_atom(*rbuf, &index, "ok");
+		encode_stats(*rbuf, &index, context, &metrics);
+	} else if (cmd == CONFIGURE_COMMAND) {
+		// buf holds `key=value` pairs as given to open_port. Anything not
+		// mentioned keeps its current setting.
+		char options_string[DRIVER_OPTIONS_MAX_LENGTH];
+		driver_options_t options = context->options;
+		size_t n = MIN(len, sizeof(options_string) - 1);
+
+		memcpy(options_string, buf, n);
+		options_string[n] = '\0';
+
+		if (driver_options_parse(&options, options_string) != 0) {
+			ei_encode_tuple_header(*rbuf, &index, 2);
+			ei_encode_atom(*rbuf, &index, "error");
+			ei_encode_atom(*rbuf, &index, "invalid_options");
+			return (ErlDrvSSizeT)index;
+		}
+
+		PaError err = reconfigure_audio_stream(context, &options);
+
+		if (err != paNoError) {
+			const char *message = Pa_GetErrorText(err);
+			int size = index;
+			ei_encode_tuple_header(NULL, &size, 2);
+			ei_encode_atom(NULL, &size, "error");
+			ei_encode_string(NULL, &size, message);
+
+			index = reserve_reply(rbuf, rlen, index, size);
+			ei_encode_tuple_header(*rbuf, &index, 2);
+			ei_encode_atom(*rbuf, &index, "error");
+			ei_encode_string(*rbuf, &index, message);
+			return (ErlDrvSSizeT)index;
+		}
+
+		int size = index;
+		ei_encode_tuple_header(NULL, &size, 2);
+		ei_encode_atom(NULL, &size, "ok");
+		encode_configuration(NULL, &size, context);
+
+		index = reserve_reply(rbuf, rlen, index, size);
+		ei_encode_tuple_header(*rbuf, &index, 2);
+		ei_encode_atom(*rbuf, &index, "ok");
+		encode_configuration(*rbuf, &index, context);
+	} else if (cmd == SNTP_COMMAND) {
+		// the broadcaster's IPv4 address & port followed by a 64 bit
+		// sequence number, all in network byte order. The reply comes back
+		// as a message once it arrives.
+		uint32_t address;
+		uint16_t port;
+		uint64_t count;
+
+		if (len != 14) {
+			ei_encode_tuple_header(*rbuf, &index, 2);
+			ei_encode_atom(*rbuf, &index, "error");
+			ei_encode_atom(*rbuf, &index, "badarg");
+			return (ErlDrvSSizeT)index;
+		}
+		memcpy(&address, buf, 4);
+		memcpy(&port, buf + 4, 2);
+		memcpy(&count, buf + 6, 8);
+		count = be64toh(count);
+
+		if (state->sntp.fd < 0) {
+			if (sntp_open(&state->sntp) < 0) {
+				ei_encode_tuple_header(*rbuf, &index, 2);
+				ei_encode_atom(*rbuf, &index, "error");
+				ei_encode_atom(*rbuf, &index, erl_errno_id(errno));
+				return (ErlDrvSSizeT)index;
+			}
+			printf("\rDRV: sntp socket open, kernel timestamps tx %d rx %d\r\n", state->sntp.kernel_tx, state->sntp.kernel_rx);
+			driver_select(state->port, (ErlDrvEvent)(intptr_t)state->sntp.fd, ERL_DRV_READ | ERL_DRV_USE, 1);
+		}
+
+		if (sntp_send(&state->sntp, address, port, count) != 0) {
+			ei_encode_tuple_header(*rbuf, &index, 2);
+			ei_encode_atom(*rbuf, &index, "error");
+			ei_encode_atom(*rbuf, &index, erl_errno_id(errno));
+			return (ErlDrvSSizeT)index;
+		}
+		ei_encode_tuple_header(*rbuf, &index, 2);
+		ei_encode_atom(*rbuf, &index, "ok");
+		ei_encode_ulonglong(*rbuf, &index, count);
 	} else if (cmd == STOP_COMMAND) {
+		reset_jitter_buffer(context);
 		context->stopped = true;
 		ei_encode_atom(*rbuf, &index, "ok");
 	}
 	return (ErlDrvSSizeT)index;
 }
 
+// sends {Port, {sntp, Count, {Originate, Receipt, Reply, Finish}}} for each
+// time sync reply, the same four timestamps as the Elixir client used to
+static void portaudio_drv_ready_input(ErlDrvData drv_data, ErlDrvEvent event)
+{
+	portaudio_state *state = (portaudio_state*)drv_data;
+	audio_callback_context *context = state->audio_context;
+	sntp_exchange_t exchange;
+
+	(void)event;
+
+	while (sntp_receive(&state->sntp, &exchange)) {
+		ErlDrvTermData term[] = {
+			ERL_DRV_PORT,   context->port_term,
+			ERL_DRV_ATOM,   state->atom_sntp,
+			ERL_DRV_UINT64, (ErlDrvTermData)&exchange.count,
+			ERL_DRV_INT64,  (ErlDrvTermData)&exchange.originate,
+			ERL_DRV_INT64,  (ErlDrvTermData)&exchange.receipt,
+			ERL_DRV_INT64,  (ErlDrvTermData)&exchange.reply,
+			ERL_DRV_INT64,  (ErlDrvTermData)&exchange.finish,
+			ERL_DRV_TUPLE,  4,
+			ERL_DRV_TUPLE,  3,
+			ERL_DRV_TUPLE,  2
+		};
+		erl_drv_output_term(context->port_term, term, sizeof(term) / sizeof(term[0]));
+	}
+}
+
+static void portaudio_drv_stop_select(ErlDrvEvent event, void *reserved)
+{
+	(void)reserved;
+	close((int)(intptr_t)event);
+}
+
 ErlDrvEntry example_driver_entry = {
 	NULL,			/* F_PTR init, called when driver is loaded */
 	portaudio_drv_start,		/* L_PTR start, called when port is opened */
 	portaudio_drv_stop,		/* F_PTR stop, called when port is closed */
 	NULL,		/* F_PTR output, called when erlang has sent */
-	NULL,			/* F_PTR ready_input, called when input descriptor ready */
+	portaudio_drv_ready_input,	/* F_PTR ready_input, called when input descriptor ready */
 	NULL,			/* F_PTR ready_output, called when output descriptor ready */
 	"janis",		/* char *driver_name, the argument to open_port */
 	NULL, //portaudio_drv_finish,			/* F_PTR finish, called when unloaded */
 	NULL,                       /* void *handle, Reserved by VM */
 	portaudio_drv_control,			/* F_PTR control, port_command callback */
 	NULL,			/* F_PTR timeout, reserved */
-	NULL,			/* F_PTR outputv, reserved */
+	portaudio_drv_outputv,			/* F_PTR outputv, called when erlang has sent an io vector */
 	NULL,                       /* F_PTR ready_async, only for async drivers */
 	NULL,                       /* F_PTR flush, called when port is about to be closed, but there is data in driver queue */
 	NULL,                       /* F_PTR call, much like control, sync call to driver */
@@ -548,7 +2119,7 @@ ErlDrvEntry example_driver_entry = {
 	0,                          /* int driver_flags, see documentation */
 	NULL,                       /* void *handle2, reserved for VM use */
 	NULL,                       /* F_PTR process_exit, called when a monitored process dies */
-	NULL,                       /* F_PTR stop_select, called to close an event object */
+	portaudio_drv_stop_select,  /* F_PTR stop_select, called to close an event object */
 	NULL                        /* emergency close */
 };
 
@@ -13,6 +13,7 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <errno.h>
 #include <sys/time.h>
 #include <sys/param.h>
 #include <sys/types.h>
@@ -32,6 +33,16 @@
 #include "monotonic_time.h"
 #include "stream_statistics.h"
 #include "pid.h"
+#include "drift_estimator.h"
+#include "packet_reader.h"
+#include "sample_kernels.h"
+#include "driver_options.h"
+#include "metrics.h"
+#include "log_ring.h"
+#include "jitter_buffer.h"
+#include "sntp.h"
+#include "clock_map.h"
+#include "pcm_output.h"
 
 // http://portaudio.com/docs/v19-doxydocs/compile_linux.html
 #ifdef __linux__
@@ -44,33 +55,68 @@
 #define STOP_COMMAND  (3)
 #define GVOL_COMMAND  (4)
 #define SVOL_COMMAND  (5)
+#define PLAY_PACKET_COMMAND (6)
+#define RESAMPLER_COMMAND (7)
+#define STATS_COMMAND (8)
+#define CONFIGURE_COMMAND (9)
+#define SNTP_COMMAND  (10)
+#define DELTA_COMMAND (11)
 
 #define USECONDS      (1000000.0)
-#define PACKET_SIZE   (1764) // 3528 bytes = 1,764 shorts
-#define PACKET_BUFFER_SIZE   (32)
-#define SAMPLE_RATE   (44100.0)
-#define CHANNEL_COUNT (2)
-// the smaller this buffer is, the more accurately we can judge the playback
-// position. It's functionally impossible to know exactly how many frames from
-// the current packet have actually been played (as this is controlled by the
-// libsamplerate code which is basically a black box).
-// There can be at most 1 buffer's worth of discrepency between the actual
-// playback position and the bytes sent to the resampler (since the resampler
-// works in buffer-sized chunks).
-#define OUTPUT_BUFFER_FRAMES (1)
-#define OUTPUT_BUFFER_SIZE   ((OUTPUT_BUFFER_FRAMES) * (CHANNEL_COUNT))
-
-#define SECONDS_PER_FRAME  (1.0 / SAMPLE_RATE)
-#define USECONDS_PER_FRAME (USECONDS / SAMPLE_RATE)
-#define FRAMES_PER_USECONDS (SAMPLE_RATE / USECONDS)
-// used to work out the time offset of the active packet based on
-// its offset, which is in individual floats, not frames. However
-// the offset will always be a multiple of 2 so this is just a convenience
-#define SECONDS_PER_FLOAT (1.0 / (SAMPLE_RATE * CHANNEL_COUNT))
-#define USECONDS_PER_FLOAT (USECONDS * SECONDS_PER_FLOAT)
+#define PACKET_HEADER_SIZE (10) // timestamp (64 bit) + len (16 bit)
+// The ring buffer is a slab of CHUNK_MS chunks, which is a whole number of
+// frames at each of the sample rates we take. Packets are split into chunks
+// as they arrive so a short packet only takes up the chunks it needs. The
+// number of chunks comes from the buffer_ms option, rounded up to the power
+// of 2 PaUtilRingBuffer needs, & their size from the stream's format (see
+// stream_format_t).
+#define CHUNK_MS         (10.0)
+#define MAX_CHUNK_FRAMES ((MAX_SAMPLE_RATE) / 100)
+#define MAX_CHUNK_SIZE   ((MAX_CHUNK_FRAMES) * (MAX_CHANNELS))
+// The resampler pulls its input in chunks of up to this many frames (see the
+// resampler_chunk_frames option). Bigger chunks mean fewer calls into
+// src_input_callback per output buffer. Because the resampler holds on to
+// some of the input it's been given, the playback position is the position
+// in the active packet less the frames the resampler hasn't used yet, which
+// we work out from the frames handed over and the frames produced at each
+// ratio (see resampler_lag). RESAMPLER_INPUT_MAX_FRAMES lives in
+// driver_options.h.
+#define RESAMPLER_INPUT_MAX_SIZE   ((RESAMPLER_INPUT_MAX_FRAMES) * (MAX_CHANNELS))
+// with overflow=evict, the oldest chunks are dropped once fewer than this
+// many slots are free so that there's room for new audio by the time the
+// audio thread has got round to it
+#define EVICT_HEADROOM_CHUNKS      (4)
+// Incoming chunks wait in the jitter buffer until they're this close to being
+// played, allowing for the housekeeping thread only committing them every
+// HOUSEKEEPING_INTERVAL_US, or they're reorder_ms behind the newest chunk.
+#define JITTER_COMMIT_LEAD_US      (60000)
+// a chunk starting within this of the end of the last one follows on from it
+#define JITTER_TOLERANCE_US        ((uint64_t)(CHUNK_MS * 500))
+// gaps between chunks are filled with silence, faded out from the last frame
+// we had & back in to the next chunk over this long. Gaps longer than the
+// max_gap_ms option stop playback & we sync up again from scratch.
+#define GAP_FADE_US                (2000)
+// when the ring buffer runs dry mid-playback the last chunk played is
+// repeated, fading out over this long, & then silence until more audio
+// turns up or we've been going for max_gap_ms
+#define CONCEAL_FADE_US            (10000)
+#define CONCEAL_BLOCK_FRAMES       (64)
+
+// resampled audio is converted to integer output formats in blocks of this
+// many frames
+#define RESAMPLE_BUFFER_FRAMES (256)
+// the resampler steps down a quality tier once the cpu load has been high
+// for this long & back up once it's been low for this long
+#define QUALITY_DOWN_S (0.5)
+#define QUALITY_UP_S   (10.0)
+// once in passthrough mode we only go back to the resampler once the ratio
+// has moved this many times the deadband away from 1
+#define PASSTHROUGH_EXIT_FACTOR (2.0)
 
 #define STREAM_STATS_WINDOW_SIZE 1000
 #define MAX_RESAMPLE_RATIO       0.01
+// the most clock skew DELTA_COMMAND will take, 500ppm
+#define MAX_CLOCK_SLEW           (0.0005)
 
 // http://stackoverflow.com/questions/3599160/unused-parameter-warnings-in-c-code
 #define UNUSED(x) (void)(x)
@@ -79,42 +125,169 @@
 
 // https://github.com/squidfunk/generic-linked-in-driver/blob/master/c_src/gen_driver.c
 
+// The format of the audio we're sent & the stream's opened with, from the
+// sample_rate, sample_bits & channels options, & the sizes & timings that
+// follow from it.
+typedef struct {
+	double        sample_rate;
+	int           channels;
+	int           sample_bits;
+	// of the audio as it comes in
+	size_t        sample_bytes;
+	size_t        frame_bytes;
+	// CHUNK_MS of audio
+	unsigned long chunk_frames;
+	unsigned long chunk_size;
+	// a timestamped_packet holding a chunk, the ring buffer's element size
+	size_t        packet_bytes;
+	double        us_per_frame;
+	double        frames_per_us;
+	// the packets' offsets & lengths are in samples, not frames
+	double        us_per_sample;
+	unsigned long gap_fade_frames;
+	unsigned long conceal_fade_frames;
+} stream_format_t;
+
 typedef struct timestamped_packet {
 	uint64_t timestamp;
-	uint16_t len; // number of floats, not byte size
-	uint16_t offset;    // number of floats, not byte size
+	uint16_t len; // number of samples, not byte size
+	uint16_t offset;    // number of samples, not byte size
 
-	float    data[PACKET_SIZE];
+	// converted to float as they're received, whatever their format, so
+	// everything after stage_chunk only deals in floats. The volume's
+	// applied as they're handed to the resampler or the output. There's
+	// room for stream_format_t.chunk_size.
+	float    data[];
 } timestamped_packet;
 
 typedef struct audio_callback_context {
 	PaStream*           audio_stream;
+	stream_format_t     format;
+	// in place of audio_stream for the backends that don't use PortAudio
+	pcm_output_t        pcm_output;
 	int                 sample_size;
 	PaUtilRingBuffer    audio_buffer;
 	timestamped_packet *audio_buffer_data;
+	ring_buffer_size_t  buffer_chunks;
 	timestamped_packet *active_packet;
 	uint64_t            stream_start_time;
 
 	uint64_t            frame_count;
+	// the latency we asked for, which the sync calculations use, & the
+	// output latency PortAudio, or the device, says it actually gave us
 	PaTime              latency;
+	PaTime              granted_latency;
 
 	bool                playing;
 	bool                stopped;
 
 	stream_statistics_t  *timestamp_offset_stats;
 
-	SRC_STATE            *resampler;
+	resampler_t          resampler;
+	// the quality asked for, set by the driver options or RESAMPLER_COMMAND.
+	// The audio thread may be running a cheaper converter if it's been
+	// stepping down because of the cpu load.
+	resampler_quality_t  resampler_quality;
+	resampler_quality_t  resampler_ceiling;
+	// how long the cpu load has been above (+ve) or below (-ve) the
+	// thresholds, in frames
+	long                 load_frames;
 
-	float                buffer[OUTPUT_BUFFER_SIZE];
+	float                buffer[RESAMPLER_INPUT_MAX_SIZE];
+	// input frames given to the resampler that it hasn't yet turned into
+	// output
+	double               resampler_lag;
 
 	pid_state_t          pid;
+	// how fast the DAC's running against our clock, fed the frames it's been
+	// sent by every callback whether we're playing or not
+	drift_estimator_t    dac_drift;
+	uint64_t             dac_frames;
 
 	float                volume;
+
+	const sample_kernels_t *kernels;
+
+	driver_options_t     options;
+
+	// true if we're copying audio straight to the output rather than through
+	// the resampler
+	bool                 passthrough;
+	// in passthrough mode, the number of input frames we owe (+ve) or are
+	// ahead by (-ve) according to the resample ratio
+	double               slip;
+	float                last_frame[MAX_CHANNELS];
+	float                resample_buffer[RESAMPLE_BUFFER_FRAMES * MAX_CHANNELS];
+
+	// the absolute time the current callback's output will be played
+	uint64_t             output_time;
+	// filled in during each callback & then published to `metrics`
+	metrics_callback_t   callback_metrics;
+	metrics_block_t      metrics;
+
+	// true while we're waiting for the first packet's time to come round
+	bool                 waiting;
+
+	// true while we're covering for audio that hasn't arrived. The clock
+	// keeps going from conceal_position, the time of the first missing
+	// frame, so that we can pick up where we should be when it does.
+	bool                 concealing;
+	uint64_t             conceal_position;
+	unsigned long        concealed_frames;
+	float                conceal_pattern[MAX_CHUNK_SIZE];
+	unsigned long        conceal_pattern_frames;
+
+	// the audio thread's log & the thread that writes it out
+	log_ring_t           log;
+	audio_thread_t       audio_thread;
+	ErlDrvTid            housekeeping_tid;
+	volatile bool        housekeeping_running;
+
+	// for the {Port, {audio_buffer, Event, Value}} messages sent to the port
+	// owner
+	ErlDrvTermData       port_term;
+	ErlDrvTermData       atom_audio_buffer;
+	ErlDrvTermData       atom_high_watermark;
+	ErlDrvTermData       atom_low_watermark;
+	ErlDrvTermData       atom_overflow;
+	// set by housekeeping once the fill passes the high watermark & cleared
+	// once it's back below the low one
+	bool                 above_high_watermark;
+
+	// incoming chunks are put in order here before going into the ring
+	// buffer. The lock is shared by the control & housekeeping threads, the
+	// audio thread never sees any of this.
+	jitter_buffer_t      jitter;
+	timestamped_packet  *jitter_chunks;
+	ErlDrvMutex         *jitter_lock;
+	// a chunk as it came in, before it's converted to float, with room for
+	// the largest samples we take
+	int32_t              staging[MAX_CHUNK_SIZE];
+	// the last frame committed, which gap fills fade out from
+	float                last_committed[MAX_CHANNELS];
+	uint64_t             duplicate_chunks;
+	uint64_t             late_chunks;
+	uint64_t             gap_chunks;
+
+	// chunks the ring buffer had no room for & chunks the audio thread
+	// has been asked to drop. Only written by the control thread.
+	uint64_t             rejected_chunks;
+	volatile uint32_t    evict_requested;
+	// only written by the audio thread
+	volatile uint32_t    evicted;
+
+	// maps our clock onto the broadcaster's, which the audio's timestamps
+	// are on. Set by DELTA_COMMAND. `mapping` is the audio thread's copy.
+	clock_map_t          clock_map;
+	clock_mapping_t      mapping;
 } audio_callback_context;
 
 typedef struct portaudio_state {
 	ErlDrvPort port;
 	audio_callback_context *audio_context;
+	// the time sync socket, opened on the first SNTP_COMMAND
+	sntp_client_t  sntp;
+	ErlDrvTermData atom_sntp;
 } portaudio_state;
 
 #endif
@@ -0,0 +1,95 @@
+#include <string.h>
+
+#include "jitter_buffer.h"
+
+void jitter_buffer_init(jitter_buffer_t *jb, uint64_t tolerance_us) {
+	jb->tolerance_us = tolerance_us;
+	jitter_buffer_reset(jb);
+}
+
+void jitter_buffer_reset(jitter_buffer_t *jb) {
+	jb->count      = 0;
+	jb->free_count = JITTER_SLOTS;
+	for (int i = 0; i < JITTER_SLOTS; i++) {
+		jb->free_slots[i] = JITTER_SLOTS - 1 - i;
+	}
+	jb->committed      = false;
+	jb->next_timestamp = 0;
+}
+
+// the same audio sent twice, give or take the time delta moving the
+// timestamps about, rather than neighbours that touch or overlap a little
+static bool same_chunk(uint64_t timestamp, uint64_t end, uint64_t other_timestamp, uint64_t other_end) {
+	uint64_t start  = (timestamp > other_timestamp) ? timestamp : other_timestamp;
+	uint64_t finish = (end < other_end) ? end : other_end;
+	uint64_t length = ((end - timestamp) < (other_end - other_timestamp)) ? (end - timestamp) : (other_end - other_timestamp);
+
+	return finish > start && (finish - start) * 2 > length;
+}
+
+int jitter_buffer_insert(jitter_buffer_t *jb, uint64_t timestamp, uint64_t end) {
+	if (jb->committed) {
+		if (end <= jb->next_timestamp) {
+			return JITTER_LATE;
+		}
+		// mostly played already
+		if (timestamp < jb->next_timestamp && (jb->next_timestamp - timestamp) * 2 > end - timestamp) {
+			return JITTER_DUPLICATE;
+		}
+	}
+
+	// find where it goes, searching from the newest as most chunks arrive
+	// in order
+	int position = jb->count;
+	while (position > 0 && jb->entries[position - 1].timestamp > timestamp) {
+		position--;
+	}
+
+	for (int i = position - 1; i <= position; i++) {
+		if (i >= 0 && i < jb->count && same_chunk(timestamp, end, jb->entries[i].timestamp, jb->entries[i].end)) {
+			return JITTER_DUPLICATE;
+		}
+	}
+
+	if (jb->free_count == 0) {
+		return JITTER_FULL;
+	}
+
+	memmove(&jb->entries[position + 1], &jb->entries[position], (jb->count - position) * sizeof(jitter_entry_t));
+
+	jitter_entry_t *entry = &jb->entries[position];
+	entry->timestamp = timestamp;
+	entry->end       = end;
+	entry->slot      = jb->free_slots[--jb->free_count];
+	jb->count++;
+
+	return entry->slot;
+}
+
+const jitter_entry_t *jitter_buffer_peek(const jitter_buffer_t *jb) {
+	return (jb->count > 0) ? &jb->entries[0] : NULL;
+}
+
+uint64_t jitter_buffer_span(const jitter_buffer_t *jb) {
+	if (jb->count == 0) { return 0; }
+	return jb->entries[jb->count - 1].end - jb->entries[0].timestamp;
+}
+
+uint64_t jitter_buffer_gap(const jitter_buffer_t *jb) {
+	if (jb->count == 0 || !jb->committed) { return 0; }
+
+	uint64_t timestamp = jb->entries[0].timestamp;
+
+	if (timestamp < jb->next_timestamp + jb->tolerance_us) { return 0; }
+	return timestamp - jb->next_timestamp;
+}
+
+void jitter_buffer_commit(jitter_buffer_t *jb) {
+	if (jb->count == 0) { return; }
+
+	jb->free_slots[jb->free_count++] = jb->entries[0].slot;
+	jb->committed      = true;
+	jb->next_timestamp = jb->entries[0].end;
+	jb->count--;
+	memmove(&jb->entries[0], &jb->entries[1], jb->count * sizeof(jitter_entry_t));
+}
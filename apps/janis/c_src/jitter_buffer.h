@@ -0,0 +1,66 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// Puts incoming chunks back into timestamp order before they go into the
+// audio thread's ring buffer.
+//
+// The ring buffer is strictly FIFO & shared lock-free with the audio thread
+// so nothing can be slotted in once it's there. Instead chunks wait here,
+// sorted by timestamp, for up to the reorder window (or until they're nearly
+// due) & are then committed in order. This only keeps track of timestamps
+// & which of the caller's JITTER_SLOTS staging slots holds each chunk, the
+// audio itself stays with the caller.
+//
+// Chunks are compared by the time they cover, [timestamp, end), as the
+// last one of a packet can be short. Once a chunk has been committed
+// anything that ends before the end of it is too late to go in & a chunk
+// that starts after the end of it leaves a gap the caller can fill. A chunk
+// that mostly overlaps a committed or waiting one is a duplicate.
+
+#define JITTER_SLOTS (64)
+
+// jitter_buffer_insert
+#define JITTER_DUPLICATE (-1)
+#define JITTER_LATE      (-2)
+#define JITTER_FULL      (-3)
+
+typedef struct {
+	uint64_t timestamp; // µs
+	uint64_t end;       // µs, the timestamp of whatever follows
+	int      slot;
+} jitter_entry_t;
+
+typedef struct {
+	// sorted by timestamp, oldest first
+	jitter_entry_t entries[JITTER_SLOTS];
+	int            count;
+	int            free_slots[JITTER_SLOTS];
+	int            free_count;
+
+	// a chunk starting within this of the end of the last one committed
+	// follows on from it, timestamps move around a little with the time
+	// delta
+	uint64_t       tolerance_us;
+
+	// the end of the last chunk committed
+	bool           committed;
+	uint64_t       next_timestamp;
+} jitter_buffer_t;
+
+void jitter_buffer_init(jitter_buffer_t *jb, uint64_t tolerance_us);
+// forgets everything, including what's been committed
+void jitter_buffer_reset(jitter_buffer_t *jb);
+
+// returns the slot to copy the chunk's audio into or JITTER_DUPLICATE,
+// JITTER_LATE or JITTER_FULL
+int  jitter_buffer_insert(jitter_buffer_t *jb, uint64_t timestamp, uint64_t end);
+
+// the oldest chunk, NULL if there isn't one
+const jitter_entry_t *jitter_buffer_peek(const jitter_buffer_t *jb);
+// µs between the oldest chunk & the end of the newest
+uint64_t jitter_buffer_span(const jitter_buffer_t *jb);
+// µs between the end of the last committed chunk & the start of the oldest
+// one, 0 if they're contiguous or nothing's been committed
+uint64_t jitter_buffer_gap(const jitter_buffer_t *jb);
+// removes the oldest chunk, which the caller has copied out, & frees its slot
+void jitter_buffer_commit(jitter_buffer_t *jb);
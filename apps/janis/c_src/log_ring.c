@@ -0,0 +1,63 @@
+#include <stdarg.h>
+#include <inttypes.h>
+
+#include "log_ring.h"
+#include "monotonic_time.h"
+
+void log_ring_init(log_ring_t *log) {
+	PaUtil_InitializeRingBuffer(&log->ring, sizeof(log_entry_t), LOG_RING_SIZE, log->entries);
+	log->dropped          = 0;
+	log->reported_dropped = 0;
+}
+
+void log_ring_printf(log_ring_t *log, const char *format, ...) {
+	void *region1, *region2;
+	ring_buffer_size_t size1, size2;
+
+	if (PaUtil_GetRingBufferWriteRegions(&log->ring, 1, &region1, &size1, &region2, &size2) == 0) {
+		log->dropped++;
+		return;
+	}
+
+	log_entry_t *entry = (log_entry_t*)region1;
+	va_list args;
+
+	entry->time = monotonic_nanoseconds() / 1000;
+
+	va_start(args, format);
+	vsnprintf(entry->message, LOG_MESSAGE_SIZE, format, args);
+	va_end(args);
+
+	PaUtil_AdvanceRingBufferWriteIndex(&log->ring, 1);
+}
+
+int log_ring_drain(log_ring_t *log, FILE *out) {
+	void *region1, *region2;
+	ring_buffer_size_t size1, size2;
+	int written = 0;
+
+	ring_buffer_size_t available = PaUtil_GetRingBufferReadRegions(&log->ring, LOG_RING_SIZE, &region1, &size1, &region2, &size2);
+
+	for (ring_buffer_size_t i = 0; i < size1; i++) {
+		log_entry_t *entry = (log_entry_t*)region1 + i;
+		fprintf(out, "[%" PRIu64 "] %s\r\n", entry->time, entry->message);
+	}
+	for (ring_buffer_size_t i = 0; i < size2; i++) {
+		log_entry_t *entry = (log_entry_t*)region2 + i;
+		fprintf(out, "[%" PRIu64 "] %s\r\n", entry->time, entry->message);
+	}
+	written = (int)available;
+
+	PaUtil_AdvanceRingBufferReadIndex(&log->ring, available);
+
+	uint32_t dropped = log->dropped;
+
+	if (dropped != log->reported_dropped) {
+		fprintf(out, "!! %" PRIu32 " audio thread log messages dropped\r\n", dropped - log->reported_dropped);
+		log->reported_dropped = dropped;
+	}
+
+	if (written > 0) { fflush(out); }
+
+	return written;
+}
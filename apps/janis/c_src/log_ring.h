@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "pa_ringbuffer.h"
+
+// Log messages from the audio thread. printf can block on the stdout lock &
+// on the write itself, which on a SCHED_FIFO thread means dropouts, so the
+// audio thread formats its messages into a fixed-size lock-free ring
+// instead & a normal thread drains them to stdout.
+//
+// There's one writer (the audio thread) & one reader (the housekeeping
+// thread). If the ring is full the message is dropped & counted.
+
+// must be a power of 2
+#define LOG_RING_SIZE    (64)
+#define LOG_MESSAGE_SIZE (120)
+
+typedef struct {
+	uint64_t time; // µs
+	char     message[LOG_MESSAGE_SIZE];
+} log_entry_t;
+
+typedef struct {
+	PaUtilRingBuffer  ring;
+	log_entry_t       entries[LOG_RING_SIZE];
+	// written by the writer, the reader keeps track of how many it's
+	// reported
+	volatile uint32_t dropped;
+	uint32_t          reported_dropped;
+} log_ring_t;
+
+void log_ring_init(log_ring_t *log);
+
+// only called by the writer. Messages don't need a line ending.
+void log_ring_printf(log_ring_t *log, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// only called by the reader, returns the number of messages written
+int  log_ring_drain(log_ring_t *log, FILE *out);
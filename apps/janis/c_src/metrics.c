@@ -0,0 +1,124 @@
+#include <string.h>
+#include <sched.h>
+
+#include "metrics.h"
+#include "pa_memorybarrier.h"
+
+void metrics_init(metrics_block_t *block) {
+	block->sequence = 0;
+	block->reset    = false;
+	memset(&block->metrics, 0, sizeof(metrics_t));
+}
+
+static void record_fill(metrics_t *metrics, long fill_ms) {
+	long bucket = fill_ms / METRICS_FILL_BUCKET_MS;
+	if (bucket < 0) { bucket = 0; }
+	if (bucket >= METRICS_FILL_BUCKETS) { bucket = METRICS_FILL_BUCKETS - 1; }
+	metrics->fill[bucket]++;
+}
+
+static void record_offset(metrics_t *metrics, int64_t offset_us) {
+	if (offset_us < -METRICS_OFFSET_RANGE_US) { offset_us = -METRICS_OFFSET_RANGE_US; }
+	if (offset_us >  METRICS_OFFSET_RANGE_US) { offset_us =  METRICS_OFFSET_RANGE_US; }
+	metrics->offset[(offset_us + METRICS_OFFSET_RANGE_US) / METRICS_OFFSET_BUCKET_US]++;
+}
+
+static void record_duration(metrics_t *metrics, uint64_t ns) {
+	int bucket = 0;
+	while (bucket < (METRICS_DURATION_BUCKETS - 1) && ns >= (1ULL << bucket)) {
+		bucket++;
+	}
+	metrics->duration[bucket]++;
+	metrics->callback_ns = ns;
+	if (ns > metrics->callback_ns_max) {
+		metrics->callback_ns_max = ns;
+	}
+}
+
+void metrics_publish(metrics_block_t *block, const metrics_callback_t *callback) {
+	metrics_t *metrics = &block->metrics;
+
+	block->sequence++;
+	PaUtil_WriteMemoryBarrier();
+
+	if (block->reset) {
+		memset(metrics, 0, sizeof(metrics_t));
+		block->reset = false;
+	}
+
+	metrics->callbacks++;
+	metrics->underruns         += callback->underrun ? 1 : 0;
+	metrics->late_packets      += callback->late_packets;
+	metrics->concealments      += callback->concealments;
+	metrics->concealed_frames  += callback->concealed_frames;
+	metrics->playing           = callback->playing;
+	metrics->passthrough       = callback->passthrough;
+	metrics->resampler_quality = callback->resampler_quality;
+	metrics->cpu_load          = callback->cpu_load;
+
+	if (callback->measured) {
+		metrics->offset_us          = callback->offset_us;
+		metrics->smoothed_offset_us = callback->smoothed_offset_us;
+		metrics->resample_ratio     = callback->resample_ratio;
+		metrics->pid_p              = callback->pid_p;
+		metrics->pid_i              = callback->pid_i;
+		metrics->pid_d              = callback->pid_d;
+		metrics->pid_ff             = callback->pid_ff;
+		metrics->pid_kp             = callback->pid_kp;
+		metrics->pid_ki             = callback->pid_ki;
+		metrics->pid_kd             = callback->pid_kd;
+		record_offset(metrics, callback->offset_us);
+	}
+
+	record_fill(metrics, callback->fill_ms);
+	record_duration(metrics, callback->duration_ns);
+
+	PaUtil_WriteMemoryBarrier();
+	block->sequence++;
+}
+
+void metrics_request_reset(metrics_block_t *block) {
+	block->reset = true;
+}
+
+void metrics_read(metrics_block_t *block, metrics_t *out) {
+	uint32_t start, end;
+
+	do {
+		while ((start = block->sequence) & 1) {
+			sched_yield();
+		}
+		PaUtil_ReadMemoryBarrier();
+		memcpy(out, &block->metrics, sizeof(metrics_t));
+		PaUtil_ReadMemoryBarrier();
+		end = block->sequence;
+	} while (start != end);
+}
+
+// the index of the bucket holding the p'th value, or -1 if empty
+static int percentile_bucket(const uint32_t *buckets, int count, double p) {
+	uint64_t total = 0, seen = 0;
+
+	for (int i = 0; i < count; i++) { total += buckets[i]; }
+	if (total == 0) { return -1; }
+
+	uint64_t rank = (uint64_t)(p * (double)total);
+
+	for (int i = 0; i < count; i++) {
+		seen += buckets[i];
+		if (seen > rank) { return i; }
+	}
+	return count - 1;
+}
+
+int64_t metrics_offset_percentile(const metrics_t *metrics, double p) {
+	int bucket = percentile_bucket(metrics->offset, METRICS_OFFSET_BUCKETS, p);
+	if (bucket < 0) { return 0; }
+	return ((int64_t)bucket * METRICS_OFFSET_BUCKET_US) - METRICS_OFFSET_RANGE_US;
+}
+
+uint64_t metrics_duration_percentile(const metrics_t *metrics, double p) {
+	int bucket = percentile_bucket(metrics->duration, METRICS_DURATION_BUCKETS, p);
+	if (bucket <= 0) { return 0; }
+	return 1ULL << bucket;
+}
@@ -0,0 +1,103 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// Playback metrics written by the audio thread & read by the control thread
+// without either of them taking a lock.
+//
+// The block is published through a seqlock: the audio thread, the only
+// writer, makes the sequence odd while it's updating the block & even again
+// when it's done. A reader copies the block & retries if the sequence was
+// odd or changed underneath it. The writer never waits.
+
+// ring buffer fill in METRICS_FILL_BUCKET_MS wide buckets, the last
+// catching everything beyond
+#define METRICS_FILL_BUCKET_MS   (20)
+#define METRICS_FILL_BUCKETS     (64)
+// signed timestamp offset in OFFSET_BUCKET_US wide buckets from
+// -METRICS_OFFSET_RANGE_US to +METRICS_OFFSET_RANGE_US, the ends catching
+// everything beyond
+#define METRICS_OFFSET_BUCKET_US (20)
+#define METRICS_OFFSET_RANGE_US  (5000)
+#define METRICS_OFFSET_BUCKETS   ((2 * METRICS_OFFSET_RANGE_US / METRICS_OFFSET_BUCKET_US) + 1)
+// callback duration, bucket n holds durations < 2^n ns
+#define METRICS_DURATION_BUCKETS (32)
+
+typedef struct {
+	uint64_t callbacks;
+	// callbacks that ran out of audio part way through playback
+	uint64_t underruns;
+	// packets that were already completely in the past when we got to them
+	uint64_t late_packets;
+	// times we've run out of audio mid-playback & covered for it, & the
+	// frames we've had to make up
+	uint64_t concealments;
+	uint64_t concealed_frames;
+
+	bool     playing;
+	bool     passthrough;
+	int      resampler_quality;
+
+	int64_t  offset_us;
+	double   smoothed_offset_us;
+	double   resample_ratio;
+	double   pid_p, pid_i, pid_d;
+	// the feed-forward term & the gains in use
+	double   pid_ff;
+	double   pid_kp, pid_ki, pid_kd;
+	double   cpu_load;
+
+	uint64_t callback_ns;
+	uint64_t callback_ns_max;
+
+	uint32_t fill[METRICS_FILL_BUCKETS];
+	uint32_t offset[METRICS_OFFSET_BUCKETS];
+	uint32_t duration[METRICS_DURATION_BUCKETS];
+} metrics_t;
+
+// what the audio thread saw during a single callback, gathered as it goes
+// & then published in one go
+typedef struct {
+	// false if we didn't get as far as comparing the packet & output times
+	bool     measured;
+	bool     underrun;
+	uint32_t late_packets;
+	uint32_t concealments;
+	uint32_t concealed_frames;
+
+	bool     playing;
+	bool     passthrough;
+	int      resampler_quality;
+
+	int64_t  offset_us;
+	double   smoothed_offset_us;
+	double   resample_ratio;
+	double   pid_p, pid_i, pid_d;
+	// the feed-forward term & the gains in use
+	double   pid_ff;
+	double   pid_kp, pid_ki, pid_kd;
+	double   cpu_load;
+
+	long     fill_ms;
+	uint64_t duration_ns;
+} metrics_callback_t;
+
+typedef struct {
+	volatile uint32_t sequence;
+	// set by the reader, cleared by the writer once it's zeroed the metrics
+	volatile bool     reset;
+	metrics_t         metrics;
+} metrics_block_t;
+
+void metrics_init(metrics_block_t *block);
+
+// only called by the audio thread
+void metrics_publish(metrics_block_t *block, const metrics_callback_t *callback);
+
+// takes a consistent copy of the block
+void metrics_read(metrics_block_t *block, metrics_t *out);
+// asks the writer to start again from zero
+void metrics_request_reset(metrics_block_t *block);
+
+// percentiles (0 < p < 1) of the histograms, to the bucket resolution
+int64_t  metrics_offset_percentile(const metrics_t *metrics, double p);
+uint64_t metrics_duration_percentile(const metrics_t *metrics, double p);
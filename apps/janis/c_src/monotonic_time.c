@@ -3,6 +3,7 @@
 #include <time.h>
 #include <sys/time.h>
 #include <inttypes.h>
+#include <math.h>
 
 
 
@@ -144,17 +145,55 @@ int clock_gettime(clockid_t clk_id, struct timespec *tp) {
 }
 #endif // __APPLE__
 
-struct timespec ts;
+#include "monotonic_time.h"
 
-uint64_t monotonic_microseconds()
+// how many times monotonic_pair tries for a tight bracket
+#define PAIR_ATTEMPTS (3)
+
+// Everything reads CLOCK_MONOTONIC rather than CLOCK_MONOTONIC_RAW: it's the
+// clock the BEAM's monotonic time & PortAudio's ALSA timestamps are based on
+// so times from either can be compared with ours, & it's read through the
+// vDSO on every kernel we run on whereas _RAW only is on recent ones. It's
+// slewed by NTP but never steps.
+//
+// Each call has its own timespec so the control & audio threads can both
+// use these at once, & the conversions are integer only.
+uint64_t monotonic_nanoseconds(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * (uint64_t)1000000000 + (uint64_t)now.tv_nsec;
+}
+
+uint64_t monotonic_microseconds(void)
+{
+	return monotonic_nanoseconds() / (uint64_t)1000;
+}
+
+uint64_t monotonic_milliseconds(void)
 {
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)(ts.tv_sec * (uint64_t)1000000) + (uint64_t)(ts.tv_nsec/1000.0);
+	return monotonic_nanoseconds() / (uint64_t)1000000;
 }
 
-uint64_t monotonic_milliseconds()
+void monotonic_pair(clock_pair_t *pair, clock_read_t read, void *arg)
 {
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (uint64_t)(ts.tv_sec * (uint64_t)1000) + (uint64_t)(ts.tv_nsec/1000000.0);
+	uint64_t best = UINT64_MAX;
+
+	for (int i = 0; i < PAIR_ATTEMPTS; i++) {
+		uint64_t before = monotonic_nanoseconds();
+		double   time   = read(arg);
+		uint64_t after  = monotonic_nanoseconds();
+
+		if (after - before < best) {
+			best               = after - before;
+			pair->monotonic_ns = before + (after - before) / 2;
+			pair->time         = time;
+		}
+	}
 }
 
+uint64_t monotonic_pair_to_microseconds(const clock_pair_t *pair, double time)
+{
+	int64_t delta_ns = (int64_t)llround((time - pair->time) * 1e9);
+	return (uint64_t)((int64_t)pair->monotonic_ns + delta_ns) / (uint64_t)1000;
+}
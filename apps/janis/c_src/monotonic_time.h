@@ -1,4 +1,21 @@
+#include <stdint.h>
 
-uint64_t monotonic_microseconds();
-uint64_t monotonic_milliseconds();
+uint64_t monotonic_microseconds(void);
+uint64_t monotonic_milliseconds(void);
+uint64_t monotonic_nanoseconds(void);
 
+// A reading of the monotonic clock paired with one of some other clock that
+// counts in seconds, such as a PortAudio stream's time, so that times on the
+// other clock can be converted to monotonic time.
+typedef struct {
+	uint64_t monotonic_ns;
+	double   time;
+} clock_pair_t;
+
+typedef double (*clock_read_t)(void *arg);
+
+// reads the other clock between two readings of the monotonic clock & pairs
+// it with their midpoint, keeping the tightest of a few tries
+void     monotonic_pair(clock_pair_t *pair, clock_read_t read, void *arg);
+// µs of monotonic time at `time` on the other clock
+uint64_t monotonic_pair_to_microseconds(const clock_pair_t *pair, double time);
@@ -0,0 +1,65 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "packet_reader.h"
+
+void packet_reader_init_buf(packet_reader_t *reader, char *buf, size_t len) {
+	reader->single.iov_base = buf;
+	reader->single.iov_len  = len;
+	reader->iov             = &reader->single;
+	reader->vsize           = 1;
+	reader->index           = 0;
+	reader->offset          = 0;
+	reader->remaining       = len;
+}
+
+void packet_reader_init_iov(packet_reader_t *reader, ErlIOVec *ev) {
+	reader->iov       = ev->iov;
+	reader->vsize     = ev->vsize;
+	reader->index     = 0;
+	reader->offset    = 0;
+	reader->remaining = ev->size;
+}
+
+// returns the number of contiguous bytes available at the read position
+static size_t current_segment(packet_reader_t *reader, char **data) {
+	while (reader->index < reader->vsize) {
+		SysIOVec *iov = &reader->iov[reader->index];
+		if (reader->offset < iov->iov_len) {
+			*data = (char*)iov->iov_base + reader->offset;
+			return iov->iov_len - reader->offset;
+		}
+		reader->index++;
+		reader->offset = 0;
+	}
+	return 0;
+}
+
+static void advance(packet_reader_t *reader, size_t len) {
+	reader->offset    += len;
+	reader->remaining -= len;
+}
+
+size_t packet_reader_read(packet_reader_t *reader, void *out, size_t len) {
+	char  *data;
+	size_t read = 0;
+	size_t available;
+
+	while (read < len && (available = current_segment(reader, &data)) > 0) {
+		size_t n = (len - read) < available ? (len - read) : available;
+		if (out != NULL) {
+			memcpy((char*)out + read, data, n);
+		}
+		advance(reader, n);
+		read += n;
+	}
+	return read;
+}
+
+size_t packet_reader_skip(packet_reader_t *reader, size_t len) {
+	return packet_reader_read(reader, NULL, len);
+}
+
+size_t packet_reader_read_samples(packet_reader_t *reader, void *out, size_t count, size_t sample_bytes) {
+	return packet_reader_read(reader, out, count * sample_bytes) / sample_bytes;
+}
@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <erl_driver.h>
+
+// Walks the incoming audio data whether it came in as a single control
+// buffer or as the (possibly fragmented) io vector handed to outputv, so
+// that it can be copied straight into the ring buffer without first being
+// gathered into one contiguous block.
+typedef struct {
+	SysIOVec  single;
+	SysIOVec *iov;
+	int       vsize;
+	int       index;     // current entry in iov
+	size_t    offset;    // read position within iov[index]
+	size_t    remaining; // total bytes left
+} packet_reader_t;
+
+void   packet_reader_init_buf(packet_reader_t *reader, char *buf, size_t len);
+void   packet_reader_init_iov(packet_reader_t *reader, ErlIOVec *ev);
+size_t packet_reader_read(packet_reader_t *reader, void *out, size_t len);
+size_t packet_reader_skip(packet_reader_t *reader, size_t len);
+// reads up to `count` samples of `sample_bytes` each
+size_t packet_reader_read_samples(packet_reader_t *reader, void *out, size_t count, size_t sample_bytes);
@@ -0,0 +1,380 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/param.h>
+
+#ifdef __linux__
+#include <alsa/asoundlib.h>
+#endif
+
+#include "monotonic_time.h"
+#include "pcm_output.h"
+
+#define DEFAULT_PERIOD_FRAMES (256)
+// the buffer when no latency's given, in periods
+#define DEFAULT_PERIODS       (4)
+#define MIN_PERIODS           (2)
+// how much each period counts towards the smoothed cpu load
+#define LOAD_SMOOTHING        (0.1)
+// so that we notice being stopped if the device goes quiet
+#define WAIT_TIMEOUT_MS       (100)
+
+static double timespec_seconds(const struct timespec *ts)
+{
+	return (double)ts->tv_sec + (double)ts->tv_nsec / 1e9;
+}
+
+static void call_back(pcm_output_t *output, void *out, unsigned long frames, double now, double dac_time)
+{
+	PaStreamCallbackTimeInfo time_info;
+
+	time_info.inputBufferAdcTime  = 0.0;
+	time_info.currentTime         = now;
+	time_info.outputBufferDacTime = dac_time;
+
+	PaStreamCallbackFlags flags = (output->xruns != output->flagged_xruns) ? paOutputUnderflow : 0;
+	output->flagged_xruns = output->xruns;
+
+	output->callback(NULL, out, frames, &time_info, flags, output->user_data);
+}
+
+static void account_load(pcm_output_t *output, uint64_t start_ns, unsigned long frames)
+{
+	double period = (double)frames / output->sample_rate;
+	double load   = (double)(monotonic_nanoseconds() - start_ns) / 1e9 / period;
+
+	output->cpu_load += LOAD_SMOOTHING * (load - output->cpu_load);
+}
+
+static void sleep_until(uint64_t ns)
+{
+	struct timespec ts = { (time_t)(ns / 1000000000ULL), (long)(ns % 1000000000ULL) };
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+// Plays a period at a time off the monotonic clock. Frame n goes to the
+// "DAC" buffer_frames after it's due to be written, the time it would have
+// spent queued in a sound card's buffer.
+static void *sink_thread(void *arg)
+{
+	pcm_output_t *output = (pcm_output_t*)arg;
+	size_t   bytes    = output->period_frames * output->channels * output->sample_size;
+	double   rate     = (double)output->sample_rate;
+	uint64_t start_ns = monotonic_nanoseconds();
+	uint64_t frames   = 0;
+
+	while (output->running) {
+		uint64_t due_ns = start_ns + (uint64_t)(frames * 1e9 / rate);
+
+		sleep_until(due_ns);
+
+		uint64_t now_ns = monotonic_nanoseconds();
+
+		// we've slept through the whole buffer, so we'd have run dry
+		if (now_ns > due_ns + (uint64_t)(output->buffer_frames * 1e9 / rate)) {
+			output->xruns++;
+			start_ns = now_ns - (uint64_t)(frames * 1e9 / rate);
+		}
+
+		double dac_time = (double)start_ns / 1e9 + (double)(frames + output->buffer_frames) / rate;
+
+		call_back(output, output->buffer, output->period_frames, (double)now_ns / 1e9, dac_time);
+
+		if (output->fd >= 0 && write(output->fd, output->buffer, bytes) != (ssize_t)bytes) {
+			// keep going, the timing matters more than the file
+			close(output->fd);
+			output->fd = -1;
+		}
+
+		account_load(output, now_ns, output->period_frames);
+		frames += output->period_frames;
+	}
+	return NULL;
+}
+
+static int open_sink(pcm_output_t *output, const char *device)
+{
+	if (output->sink == PCM_OUTPUT_FILE) {
+		if (device[0] == '\0') { return -EINVAL; }
+		output->fd = open(device, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (output->fd < 0) { return -errno; }
+	}
+
+	output->buffer = calloc(output->period_frames, output->channels * output->sample_size);
+
+	if (output->buffer == NULL) { return -ENOMEM; }
+	return 0;
+}
+
+#ifdef __linux__
+
+static snd_pcm_format_t alsa_format(int sample_size, bool is_float)
+{
+	if (is_float) { return SND_PCM_FORMAT_FLOAT; }
+	return (sample_size == 2) ? SND_PCM_FORMAT_S16 : SND_PCM_FORMAT_S32;
+}
+
+static void alsa_recover(pcm_output_t *output, int err)
+{
+	if (snd_pcm_recover((snd_pcm_t*)output->pcm, err, 1) == 0) {
+		output->xruns++;
+	}
+}
+
+// When the next frame we write will reach the DAC: the delay the driver
+// gives us, as of its timestamp. Until the stream starts, which it does
+// as soon as the buffer's full, there's no timestamp but the delay is just
+// what's been queued.
+static double alsa_dac_time(pcm_output_t *output, snd_pcm_status_t *status, double now)
+{
+	snd_htimestamp_t stamp;
+
+	if (snd_pcm_status((snd_pcm_t*)output->pcm, status) < 0) { return now; }
+
+	double delay = (double)snd_pcm_status_get_delay(status) / output->sample_rate;
+
+	snd_pcm_status_get_htstamp(status, &stamp);
+
+	if (snd_pcm_status_get_state(status) != SND_PCM_STATE_RUNNING || (stamp.tv_sec == 0 && stamp.tv_nsec == 0)) {
+		return now + delay;
+	}
+	return timespec_seconds(&stamp) + delay;
+}
+
+static void *alsa_thread(void *arg)
+{
+	pcm_output_t *output = (pcm_output_t*)arg;
+	snd_pcm_t *pcm = (snd_pcm_t*)output->pcm;
+	snd_pcm_status_t *status;
+	int err;
+
+	snd_pcm_status_alloca(&status);
+
+	while (output->running) {
+		snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+
+		if (avail < 0) {
+			alsa_recover(output, (int)avail);
+			continue;
+		}
+		if ((snd_pcm_uframes_t)avail < output->period_frames) {
+			if ((err = snd_pcm_wait(pcm, WAIT_TIMEOUT_MS)) < 0) {
+				alsa_recover(output, err);
+			}
+			continue;
+		}
+
+		uint64_t start_ns = monotonic_nanoseconds();
+		double   now      = (double)start_ns / 1e9;
+		double   dac_time = alsa_dac_time(output, status, now);
+
+		const snd_pcm_channel_area_t *areas;
+		snd_pcm_uframes_t offset;
+		snd_pcm_uframes_t frames = output->period_frames;
+
+		if ((err = snd_pcm_mmap_begin(pcm, &areas, &offset, &frames)) < 0) {
+			alsa_recover(output, err);
+			continue;
+		}
+
+		// interleaved, so every channel's in the first area. We may get less
+		// than a period where the ring wraps round.
+		char *out = (char*)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+
+		call_back(output, out, frames, now, dac_time);
+
+		snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, frames);
+
+		if (committed < 0 || (snd_pcm_uframes_t)committed != frames) {
+			alsa_recover(output, committed < 0 ? (int)committed : -EPIPE);
+		}
+
+		account_load(output, start_ns, frames);
+	}
+	return NULL;
+}
+
+static int configure_alsa(pcm_output_t *output, snd_pcm_t *pcm, bool is_float, double latency)
+{
+	snd_pcm_hw_params_t *hw;
+	snd_pcm_sw_params_t *sw;
+	snd_pcm_uframes_t period = output->period_frames;
+	snd_pcm_uframes_t buffer;
+	int dir = 0;
+	int err;
+
+	snd_pcm_hw_params_alloca(&hw);
+	snd_pcm_sw_params_alloca(&sw);
+
+	if ((err = snd_pcm_hw_params_any(pcm, hw)) < 0) { return err; }
+	if ((err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0) { return err; }
+	if ((err = snd_pcm_hw_params_set_format(pcm, hw, alsa_format(output->sample_size, is_float))) < 0) { return err; }
+	if ((err = snd_pcm_hw_params_set_channels(pcm, hw, output->channels)) < 0) { return err; }
+	if ((err = snd_pcm_hw_params_set_rate(pcm, hw, output->sample_rate, 0)) < 0) { return err; }
+	if ((err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, &dir)) < 0) { return err; }
+
+	buffer = MAX((snd_pcm_uframes_t)(latency * output->sample_rate), MIN_PERIODS * period);
+
+	if ((err = snd_pcm_hw_params_set_buffer_size_near(pcm, hw, &buffer)) < 0) { return err; }
+	if ((err = snd_pcm_hw_params(pcm, hw)) < 0) { return err; }
+
+	output->period_frames = period;
+	output->buffer_frames = buffer;
+
+	// start as soon as the buffer's full, wake us whenever there's a period
+	// free & timestamp the status on the same clock as everything else
+	if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0) { return err; }
+	if ((err = snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer)) < 0) { return err; }
+	if ((err = snd_pcm_sw_params_set_avail_min(pcm, sw, period)) < 0) { return err; }
+	if ((err = snd_pcm_sw_params_set_tstamp_mode(pcm, sw, SND_PCM_TSTAMP_ENABLE)) < 0) { return err; }
+	if ((err = snd_pcm_sw_params_set_tstamp_type(pcm, sw, SND_PCM_TSTAMP_TYPE_MONOTONIC)) < 0) { return err; }
+	return snd_pcm_sw_params(pcm, sw);
+}
+
+static int open_alsa(pcm_output_t *output, const char *device, bool is_float, double latency)
+{
+	snd_pcm_t *pcm;
+	int err;
+
+	if (device[0] == '\0') { device = "default"; }
+
+	if ((err = snd_pcm_open(&pcm, device, SND_PCM_STREAM_PLAYBACK, 0)) < 0) { return err; }
+
+	if ((err = configure_alsa(output, pcm, is_float, latency)) < 0) {
+		snd_pcm_close(pcm);
+		return err;
+	}
+	output->pcm = pcm;
+	return 0;
+}
+
+static void close_alsa(pcm_output_t *output)
+{
+	snd_pcm_drop((snd_pcm_t*)output->pcm);
+	snd_pcm_close((snd_pcm_t*)output->pcm);
+}
+
+#else
+
+static int open_alsa(pcm_output_t *output, const char *device, bool is_float, double latency)
+{
+	(void)output;
+	(void)device;
+	(void)is_float;
+	(void)latency;
+	return -ENOSYS;
+}
+
+static void close_alsa(pcm_output_t *output)
+{
+	(void)output;
+}
+
+#endif
+
+static void release(pcm_output_t *output)
+{
+	if (output->pcm != NULL) {
+		close_alsa(output);
+		output->pcm = NULL;
+	}
+	if (output->fd >= 0) {
+		close(output->fd);
+		output->fd = -1;
+	}
+	free(output->buffer);
+	output->buffer = NULL;
+}
+
+int pcm_output_open(pcm_output_t *output, pcm_sink_t sink, const char *device,
+		int sample_size, bool is_float, unsigned int sample_rate, int channels,
+		unsigned long period_frames, double latency,
+		PaStreamCallback *callback, void *user_data)
+{
+	int err;
+
+	memset(output, 0, sizeof(pcm_output_t));
+	output->sink          = sink;
+	output->callback      = callback;
+	output->user_data     = user_data;
+	output->sample_rate   = sample_rate;
+	output->channels      = channels;
+	output->sample_size   = sample_size;
+	output->period_frames = (period_frames > 0) ? period_frames : DEFAULT_PERIOD_FRAMES;
+	output->fd            = -1;
+
+	if (latency <= 0.0) {
+		latency = (double)(DEFAULT_PERIODS * output->period_frames) / sample_rate;
+	}
+
+	if (sink == PCM_OUTPUT_ALSA) {
+		err = open_alsa(output, device, is_float, latency);
+	} else {
+		output->buffer_frames = MAX((unsigned long)(latency * sample_rate), MIN_PERIODS * output->period_frames);
+		err = open_sink(output, device);
+	}
+
+	if (err < 0) {
+		release(output);
+		return err;
+	}
+	output->open = true;
+	return 0;
+}
+
+int pcm_output_start(pcm_output_t *output)
+{
+	int err;
+
+	output->running = true;
+
+	err = pthread_create(&output->thread, NULL, (output->sink == PCM_OUTPUT_ALSA) ? alsa_thread : sink_thread, output);
+
+	if (err != 0) {
+		output->running = false;
+		return -err;
+	}
+	return 0;
+}
+
+void pcm_output_close(pcm_output_t *output)
+{
+	if (!output->open) { return; }
+
+	if (output->running) {
+		output->running = false;
+		pthread_join(output->thread, NULL);
+	}
+	release(output);
+	output->open = false;
+}
+
+double pcm_output_latency(const pcm_output_t *output)
+{
+	return (double)output->buffer_frames / output->sample_rate;
+}
+
+double pcm_output_cpu_load(const pcm_output_t *output)
+{
+	return output->cpu_load;
+}
+
+double pcm_output_time(void *output)
+{
+	(void)output;
+	return (double)monotonic_nanoseconds() / 1e9;
+}
+
+const char *pcm_output_error(int err)
+{
+#ifdef __linux__
+	return snd_strerror(err);
+#else
+	return strerror(-err);
+#endif
+}
@@ -0,0 +1,80 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <portaudio.h>
+
+// Output that bypasses PortAudio, for backend=alsa, null or file.
+//
+// With PortAudio the audio goes through its own buffer on the way to ALSA &
+// all we know of the timing is outputBufferDacTime, which is only as good
+// as the host API's latency estimate. Here our own thread writes straight
+// into the ALSA mmap ring (snd_pcm_mmap_begin/commit) & works out when the
+// first frame of each buffer will reach the DAC from the driver's status:
+// the delay, in frames, as of the kernel's timestamp on the monotonic clock.
+//
+// The null & file sinks stand in for a sound card. They pace themselves off
+// the monotonic clock as if they had a buffer of `latency` & the file sink
+// writes what would have been played to `device`, raw & interleaved.
+//
+// The thread calls the same PaStreamCallback as PortAudio would, with a
+// stream time that's the monotonic clock in seconds.
+
+typedef enum {
+	PCM_OUTPUT_ALSA = 0,
+	PCM_OUTPUT_NULL,
+	PCM_OUTPUT_FILE
+} pcm_sink_t;
+
+typedef struct {
+	pcm_sink_t         sink;
+	PaStreamCallback  *callback;
+	void              *user_data;
+
+	unsigned int       sample_rate;
+	int                channels;
+	int                sample_size;
+	unsigned long      period_frames;
+	unsigned long      buffer_frames;
+
+	void              *pcm;
+	int                fd;
+	// a period of audio for the null & file sinks
+	void              *buffer;
+
+	bool               open;
+	pthread_t          thread;
+	volatile bool      running;
+
+	// the fraction of each period spent in the callback, smoothed. Only
+	// read from the callback.
+	double             cpu_load;
+	// ALSA xruns we've had to recover from, or for the sinks the times
+	// we've slept through the whole buffer
+	volatile unsigned long xruns;
+	// the xruns as of the last callback, which is flagged paOutputUnderflow
+	// if there's been one since, as PortAudio would
+	unsigned long      flagged_xruns;
+} pcm_output_t;
+
+// Opens `device` for samples of `sample_size` bytes, signed ints or floats,
+// to call `callback` every `period_frames` (0 picks a default) with up to
+// `latency` seconds of audio queued ahead of the DAC. Returns 0 or a
+// negative errno.
+int    pcm_output_open(pcm_output_t *output, pcm_sink_t sink, const char *device,
+		int sample_size, bool is_float, unsigned int sample_rate, int channels,
+		unsigned long period_frames, double latency,
+		PaStreamCallback *callback, void *user_data);
+// starts the thread, which calls `callback` straight away, so anything it
+// reads must be set up first. Returns 0 or a negative errno.
+int    pcm_output_start(pcm_output_t *output);
+// stops the thread, if it was started, & closes the device
+void   pcm_output_close(pcm_output_t *output);
+
+// the buffer we were actually given, in seconds
+double pcm_output_latency(const pcm_output_t *output);
+double pcm_output_cpu_load(const pcm_output_t *output);
+// the stream time, i.e. monotonic seconds
+double pcm_output_time(void *output);
+
+const char *pcm_output_error(int err);
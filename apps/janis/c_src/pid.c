@@ -1,13 +1,106 @@
 #include "pid.h"
 
-void pid_init(pid_state_t *pid, double kp, double ki, double kd, double di_cutoff) {
-	pid->kp = kp;
-	pid->ki = ki;
-	pid->kd = kd;
-	pid->di_cutoff = di_cutoff;
+// E|Δ²e| for white noise of σ = 1, i.e. sqrt(6) * sqrt(2 / π)
+#define SECOND_DIFFERENCE_MEAN (1.9544)
+
+void pid_init(pid_state_t *pid, pid_gains_t fine, pid_gains_t coarse, double fine_error, double coarse_error,
+		double limit, double tracking) {
+	pid->fine = fine;
+	pid->coarse = coarse;
+	pid->fine_error = fine_error;
+	pid->coarse_error = coarse_error;
+	pid->limit = limit * 1e6;
+	pid->tracking = tracking;
+	pid->feed_forward = 0.;
+	pid->autotune.active = false;
+	pid->autotune.finished = false;
+	pid_reset(pid);
+}
+
+void pid_reset(pid_state_t *pid) {
 	pid->t = 0.;
 	pid->previous_error = 0.;
-	pid->integral = 0.;
+	pid->gains = pid->fine;
+	pid->p = pid->i = pid->d = 0.;
+}
+
+void pid_set_feed_forward(pid_state_t *pid, double feed_forward) {
+	pid->feed_forward = feed_forward * 1e6;
+}
+
+static pid_gains_t scheduled_gains(pid_state_t *pid, double error) {
+	double span = pid->coarse_error - pid->fine_error;
+	double w;
+
+	if (span <= 0.0) {
+		w = (fabs(error) > pid->fine_error) ? 1.0 : 0.0;
+	} else {
+		w = fmin(fmax((fabs(error) - pid->fine_error) / span, 0.0), 1.0);
+	}
+
+	// the integral fades out faster than the others so that it doesn't
+	// wind up on the way in from a large error & overshoot
+	pid_gains_t gains = {
+		pid->fine.kp + w * (pid->coarse.kp - pid->fine.kp),
+		pid->coarse.ki + pow(1.0 - w, 4.0) * (pid->fine.ki - pid->coarse.ki),
+		pid->fine.kd + w * (pid->coarse.kd - pid->fine.kd)
+	};
+	return gains;
+}
+
+void pid_autotune_start(pid_state_t *pid, double seconds, double noise_ppm) {
+	pid_autotune_t *tune = &pid->autotune;
+
+	tune->active    = true;
+	tune->finished  = false;
+	tune->seconds   = seconds;
+	tune->noise_ppm = noise_ppm;
+	tune->start     = 0.;
+	tune->dt_sum    = 0.;
+	tune->noise_sum = 0.;
+	tune->count     = 0;
+	tune->period    = 0.;
+	tune->noise     = 0.;
+}
+
+bool pid_autotune_finished(pid_state_t *pid) {
+	bool finished = pid->autotune.finished;
+	pid->autotune.finished = false;
+	return finished;
+}
+
+static void autotune(pid_state_t *pid, double time, double dt, double error) {
+	pid_autotune_t *tune = &pid->autotune;
+
+	if (tune->start == 0.0) {
+		tune->start = time;
+	}
+	if (tune->count >= 2) {
+		tune->dt_sum    += dt;
+		tune->noise_sum += fabs(error - 2.0 * tune->errors[1] + tune->errors[0]);
+	}
+	tune->errors[0] = tune->errors[1];
+	tune->errors[1] = error;
+	tune->count++;
+
+	if (time - tune->start < tune->seconds || tune->count < 3) { return; }
+
+	unsigned long n = tune->count - 2;
+	tune->period = tune->dt_sum / n;
+	tune->noise  = tune->noise_sum / n / SECOND_DIFFERENCE_MEAN;
+
+	// & never more than the coarse gain, so the schedule still goes from
+	// gentle to hard as the error grows
+	double kp = fmin(1.0 / (2.0 * tune->period), pid->coarse.kp);
+	if (tune->noise > 0.0) {
+		kp = fmin(kp, tune->noise_ppm / tune->noise);
+	}
+	pid->fine.kp = kp;
+	pid->fine.ki = kp * kp / 4.0;
+	pid->fine.kd = 0.0;
+
+	tune->active   = false;
+	tune->finished = true;
 }
 
 double pid_control(
@@ -16,30 +109,41 @@ double pid_control(
 		double measured_value,
 		double setpoint)
 {
+	double error = setpoint - measured_value;
+
 	if (pid->t == 0.0) {
 		pid->t = time;
+		pid->previous_error = error;
 		return 0.0;
 	}
 	double dt = time - pid->t;
-	double error = setpoint - measured_value;
-  double integral, derivative;
-
-  if (fabs(error) > pid->di_cutoff) {
-    integral = 0.0;
-    derivative = 0.0;
-  } else {
-    integral = pid->integral + (error * dt);
-    derivative = (error - pid->previous_error) / dt;
-    pid->integral = integral;
-  }
-	double output = pid->kp * error + pid->ki * integral + pid->kd * derivative;
+
+	if (dt <= 0.0) {
+		return fmin(fmax(pid->p + pid->i + pid->d + pid->feed_forward, -pid->limit), pid->limit) / 1000000.0;
+	}
+
+	if (pid->autotune.active) {
+		autotune(pid, time, dt, error);
+	}
+
+	pid->gains = scheduled_gains(pid, error);
+
+	pid->p  = pid->gains.kp * error;
+	pid->i += pid->gains.ki * error * dt;
+	pid->d  = pid->gains.kd * (error - pid->previous_error) / dt;
+
+	double output  = pid->p + pid->i + pid->d + pid->feed_forward;
+	double limited = fmin(fmax(output, -pid->limit), pid->limit);
+
+	// back-calculation, only ever unwinding the integral
+	double excess = output - limited;
+	if (excess > 0.0 && pid->i > 0.0) {
+		pid->i = fmax(pid->i - excess * dt / pid->tracking, 0.0);
+	} else if (excess < 0.0 && pid->i < 0.0) {
+		pid->i = fmin(pid->i - excess * dt / pid->tracking, 0.0);
+	}
+
 	pid->previous_error = error;
 	pid->t = time;
-	return output/1000000.0;
-}
-
-void pid_reset(pid_state_t *pid) {
-	pid->t = 0.;
-	pid->previous_error = 0.;
-	pid->integral = 0.;
+	return limited / 1000000.0;
 }
@@ -1,13 +1,84 @@
+#include <stdbool.h>
 #include <math.h>
 
+// The controller that keeps playback lined up with the audio's timestamps.
+// The error is in µs & the terms in ppm, the output being a resample ratio
+// correction, i.e. the sum divided by 1e6.
+//
+// - Gain scheduling: the `fine` gains are used while |error| is within
+//   `fine_error` & the `coarse` ones beyond `coarse_error`, interpolated in
+//   between. A start or a jump in the time delta can be pulled in hard with
+//   no integral to overshoot & no derivative kick, while a small error is
+//   held with gains tuned for the measurement noise.
+// - Anti-windup: the integral is kept as its share of the output, so a change
+//   of gains doesn't bump the output. While the output's beyond ±`limit` it
+//   backs off towards 0 by whatever was cut off, over `tracking` seconds
+//   (back-calculation). It's never pushed past 0 as the P term alone can
+//   hold the output at the limit for a while & would otherwise wind it up
+//   the other way.
+// - Feed-forward: a correction that's known, the DAC's measured drift, goes
+//   in ahead of the limit so the integral only has to find what's left.
+// - Auto-tune: see pid_autotune_start.
+
 typedef struct {
 	double kp, ki, kd;
+} pid_gains_t;
+
+typedef struct {
+	bool   active;
+	// s, how long to measure for & when we started
+	double seconds;
+	double start;
+	// the callback period, & the noise on the error taken from its second
+	// differences which the steady approach to the setpoint drops out of
+	double dt_sum;
+	double noise_sum;
+	unsigned long count;
+	double errors[2];
+	// set when the gains have just been tuned, until pid_autotune_finished
+	// says so
+	bool   finished;
+	// the most ratio noise, in ppm, the P term's allowed to add
+	double noise_ppm;
+	// what was measured
+	double period;
+	double noise;
+} pid_autotune_t;
+
+typedef struct {
+	pid_gains_t fine, coarse;
+	double fine_error, coarse_error;
+	double limit;
+	double tracking;
+	// ppm
+	double feed_forward;
+
 	double t;
 	double previous_error;
-	double integral;
-	double di_cutoff;
+	pid_autotune_t autotune;
+
+	// the gains, proportional, integral & derivative terms of the last output
+	pid_gains_t gains;
+	double p, i, d;
 } pid_state_t;
 
-void pid_init(pid_state_t *pid, double kp, double ki, double kd, double di_cutoff);
+void pid_init(pid_state_t *pid, pid_gains_t fine, pid_gains_t coarse, double fine_error, double coarse_error,
+		double limit, double tracking);
+// forgets the last error & the integral, keeping the gains & feed-forward
 void pid_reset(pid_state_t *pid);
+// a ratio correction, like the output
+void pid_set_feed_forward(pid_state_t *pid, double feed_forward);
+// returns the correction, within ±limit
 double pid_control(pid_state_t *pid, double time, double measured_value, double setpoint);
+
+// Identifies the loop over the first `seconds` of control & replaces the
+// fine gains with ones to suit it. The plant's an integrator, 1 µs/s of
+// error per ppm of correction, behind a dead time of about one callback
+// period, θ. The correction is also limited by the noise on the measured
+// error, σ, as the P term turns it straight into ratio noise. So, by the
+// SIMC rules for an integrating process:
+//
+//     kp = min(1 / 2θ, noise_ppm / σ, coarse kp), ki = kp² / 4, kd = 0
+void pid_autotune_start(pid_state_t *pid, double seconds, double noise_ppm);
+// true once, after the gains have been tuned
+bool pid_autotune_finished(pid_state_t *pid);
@@ -0,0 +1,177 @@
+#include <string.h>
+
+#include "resampler.h"
+
+static const char *quality_names[] = {
+	[RESAMPLER_LINEAR]       = "linear",
+	[RESAMPLER_CUBIC]        = "cubic",
+	[RESAMPLER_SINC_FASTEST] = "fastest",
+	[RESAMPLER_SINC_MEDIUM]  = "medium",
+	[RESAMPLER_SINC_BEST]    = "best"
+};
+
+static const int sinc_converters[] = {
+	SRC_SINC_FASTEST,
+	SRC_SINC_MEDIUM_QUALITY,
+	SRC_SINC_BEST_QUALITY
+};
+
+#define SINC_COUNT (RESAMPLER_QUALITY_COUNT - RESAMPLER_SINC_FASTEST)
+
+static inline bool is_sinc(resampler_quality_t quality) {
+	return quality >= RESAMPLER_SINC_FASTEST;
+}
+
+static inline SRC_STATE *sinc_state(resampler_t *resampler) {
+	return resampler->sinc[resampler->quality - RESAMPLER_SINC_FASTEST];
+}
+
+static void interpolator_reset(interpolator_t *interpolator) {
+	memset(interpolator->history, 0, sizeof(interpolator->history));
+	interpolator->oldest       = 0;
+	interpolator->frac         = 0.0;
+	interpolator->primed       = 0;
+	interpolator->input        = NULL;
+	interpolator->input_frames = 0;
+	interpolator->input_pos    = 0;
+}
+
+int resampler_init(resampler_t *resampler, resampler_quality_t quality, int channels, resampler_input_fn input, void *cb_data) {
+	int error = 0;
+
+	memset(resampler, 0, sizeof(resampler_t));
+
+	if (channels > RESAMPLER_MAX_CHANNELS) { return RESAMPLER_ERR_CHANNELS; }
+
+	resampler->quality  = quality;
+	resampler->channels = channels;
+	resampler->input    = input;
+	resampler->cb_data  = cb_data;
+
+	for (int i = 0; i < SINC_COUNT; i++) {
+		resampler->sinc[i] = src_callback_new(input, sinc_converters[i], channels, &error, cb_data);
+		if (resampler->sinc[i] == NULL) {
+			resampler_free(resampler);
+			return error;
+		}
+	}
+
+	interpolator_reset(&resampler->interpolator);
+	return 0;
+}
+
+void resampler_free(resampler_t *resampler) {
+	for (int i = 0; i < SINC_COUNT; i++) {
+		if (resampler->sinc[i] != NULL) {
+			src_delete(resampler->sinc[i]);
+			resampler->sinc[i] = NULL;
+		}
+	}
+}
+
+void resampler_reset(resampler_t *resampler) {
+	if (is_sinc(resampler->quality)) {
+		src_reset(sinc_state(resampler));
+	} else {
+		interpolator_reset(&resampler->interpolator);
+	}
+}
+
+void resampler_set_quality(resampler_t *resampler, resampler_quality_t quality) {
+	resampler->quality = quality;
+	resampler_reset(resampler);
+}
+
+// moves the history along one frame, pulling the new frame from the input
+// callback when we've used up the last block
+static bool shift_input(resampler_t *resampler) {
+	interpolator_t *in = &resampler->interpolator;
+	size_t frame_size  = resampler->channels * sizeof(float);
+
+	if (in->input_pos >= in->input_frames) {
+		in->input_frames = resampler->input(resampler->cb_data, &in->input);
+		in->input_pos    = 0;
+		if (in->input_frames <= 0) {
+			in->input_frames = 0;
+			return false;
+		}
+	}
+
+	// the new frame replaces the oldest
+	memcpy(in->history[in->oldest], in->input + (in->input_pos * resampler->channels), frame_size);
+	in->oldest = (in->oldest + 1) & 3;
+	in->input_pos++;
+	return true;
+}
+
+static long interpolate(resampler_t *resampler, double ratio, long frames, float *out) {
+	interpolator_t *in = &resampler->interpolator;
+	const bool cubic   = resampler->quality == RESAMPLER_CUBIC;
+	const double step  = 1.0 / ratio;
+	const int channels = resampler->channels;
+	long produced = 0;
+
+	while (produced < frames) {
+		// the first input frame lines up with the first output frame so we
+		// need it & the two after it loaded before we start
+		while (in->primed < 3 || in->frac >= 1.0) {
+			if (!shift_input(resampler)) { return produced; }
+			if (in->primed < 3) {
+				in->primed++;
+			} else {
+				in->frac -= 1.0;
+			}
+		}
+
+		const float t = (float)in->frac;
+		const float *y0 = in->history[in->oldest];
+		const float *y1 = in->history[(in->oldest + 1) & 3];
+		const float *y2 = in->history[(in->oldest + 2) & 3];
+		const float *y3 = in->history[(in->oldest + 3) & 3];
+
+		if (cubic) {
+			// Catmull-Rom
+			for (int c = 0; c < channels; c++) {
+				out[c] = y1[c] + 0.5f * t * (y2[c] - y0[c] + t * (2.0f * y0[c] - 5.0f * y1[c] + 4.0f * y2[c] - y3[c] + t * (3.0f * (y1[c] - y2[c]) + y3[c] - y0[c])));
+			}
+		} else {
+			for (int c = 0; c < channels; c++) {
+				out[c] = y1[c] + t * (y2[c] - y1[c]);
+			}
+		}
+
+		out += channels;
+		produced++;
+		in->frac += step;
+	}
+	return produced;
+}
+
+long resampler_read(resampler_t *resampler, double ratio, long frames, float *out) {
+	if (!is_sinc(resampler->quality)) {
+		return interpolate(resampler, ratio, frames, out);
+	}
+
+	SRC_STATE *state = sinc_state(resampler);
+	// tell src not to smoothly transition to the new resample ratio
+	src_set_ratio(state, ratio);
+	return src_callback_read(state, ratio, frames, out);
+}
+
+int resampler_error(resampler_t *resampler) {
+	return is_sinc(resampler->quality) ? src_error(sinc_state(resampler)) : 0;
+}
+
+const char *resampler_quality_name(resampler_quality_t quality) {
+	return quality_names[quality];
+}
+
+bool resampler_quality_parse(const char *name, resampler_quality_t *quality) {
+	for (int i = 0; i < RESAMPLER_QUALITY_COUNT; i++) {
+		if (strcmp(name, quality_names[i]) == 0) {
+			*quality = (resampler_quality_t)i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,64 @@
+#include <stdbool.h>
+#include <samplerate.h>
+
+// Wraps the choice of sample rate converter: one of libsamplerate's sinc
+// converters or a built-in linear/cubic interpolator. Every converter is
+// allocated up front so switching between them from the audio callback
+// doesn't allocate.
+//
+// All the converters share libsamplerate's callback convention: input is
+// pulled through `input` as needed and output frame n lines up with input
+// frame n / ratio.
+
+#define RESAMPLER_MAX_CHANNELS (8)
+// libsamplerate's own error codes are all positive
+#define RESAMPLER_ERR_CHANNELS (-1)
+
+// in order of increasing cost
+typedef enum {
+	RESAMPLER_LINEAR = 0,
+	RESAMPLER_CUBIC,
+	RESAMPLER_SINC_FASTEST,
+	RESAMPLER_SINC_MEDIUM,
+	RESAMPLER_SINC_BEST,
+	RESAMPLER_QUALITY_COUNT
+} resampler_quality_t;
+
+typedef long (*resampler_input_fn)(void *cb_data, float **data);
+
+typedef struct {
+	// the last four input frames, oldest at history[oldest]. The output
+	// position is `frac` of the way between the second & third of them.
+	float  history[4][RESAMPLER_MAX_CHANNELS];
+	int    oldest;
+	double frac;
+	// the number of input frames shifted into the history since a reset
+	int    primed;
+	float *input;
+	long   input_frames;
+	long   input_pos;
+} interpolator_t;
+
+typedef struct {
+	resampler_quality_t quality;
+	int                 channels;
+	resampler_input_fn  input;
+	void               *cb_data;
+	SRC_STATE          *sinc[RESAMPLER_QUALITY_COUNT - RESAMPLER_SINC_FASTEST];
+	interpolator_t      interpolator;
+} resampler_t;
+
+// returns 0, RESAMPLER_ERR_CHANNELS or a libsamplerate error code
+int  resampler_init(resampler_t *resampler, resampler_quality_t quality, int channels, resampler_input_fn input, void *cb_data);
+void resampler_free(resampler_t *resampler);
+
+// discards any input held by the current converter
+void resampler_reset(resampler_t *resampler);
+// switches converter, starting the new one from scratch
+void resampler_set_quality(resampler_t *resampler, resampler_quality_t quality);
+
+long resampler_read(resampler_t *resampler, double ratio, long frames, float *out);
+int  resampler_error(resampler_t *resampler);
+
+const char *resampler_quality_name(resampler_quality_t quality);
+bool        resampler_quality_parse(const char *name, resampler_quality_t *quality);
@@ -0,0 +1,192 @@
+#include <math.h>
+
+#include "sample_kernels.h"
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(__SSE2__)
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+// 1/32768 is a power of two, so scaling the gain by it is exact & fusing the
+// conversion with the volume gives the same result as doing them in turn.
+#define S16_SCALE (1.0f / 32768.0f)
+// 24 bit samples are read into the top of an int32 so share its scale
+#define S32_SCALE (1.0f / 2147483648.0f)
+
+// The scalar conversion from each incoming format, which differ only in the
+// sample type, how a sample's read & its full scale.
+#define DEFINE_TO_FLOAT(name, type, read, full_scale) \
+	static void name(const type *in, float *out, size_t len, float gain) \
+	{ \
+		const float scale = gain * (full_scale); \
+		for (size_t i = 0; i < len; i++) { \
+			out[i] = scale * (float)(read); \
+		} \
+	}
+
+static inline int32_t read_s24(const uint8_t *in)
+{
+	return (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 24);
+}
+
+DEFINE_TO_FLOAT(s16_to_float_scalar, int16_t, in[i], S16_SCALE)
+DEFINE_TO_FLOAT(s24_to_float_scalar, uint8_t, read_s24(in + 3 * i), S32_SCALE)
+DEFINE_TO_FLOAT(s32_to_float_scalar, int32_t, in[i], S32_SCALE)
+
+// The conversions to the output's format are simple enough that the
+// compiler does a decent job of vectorising them, so all the kernel sets
+// share these. The integer ones are the same bar the type & the precision
+// needed to hold the full scale.
+#define DEFINE_FLOAT_TO_INT(name, type, real, full_scale, round) \
+	static void name(const float *in, type *out, size_t len, float gain) \
+	{ \
+		const real scale = (real)gain * (full_scale); \
+		for (size_t i = 0; i < len; i++) { \
+			real s = (real)in[i] * scale; \
+			s = s >  ((full_scale) - 1) ?  ((full_scale) - 1) : s; \
+			s = s < -(full_scale) ? -(full_scale) : s; \
+			out[i] = (type)round(s); \
+		} \
+	}
+
+DEFINE_FLOAT_TO_INT(float_to_s16_scalar, int16_t, float, 32768.0f, lrintf)
+DEFINE_FLOAT_TO_INT(float_to_s32_scalar, int32_t, double, 2147483648.0, llrint)
+
+static void float_to_float_scalar(const float *in, float *out, size_t len, float gain)
+{
+	for (size_t i = 0; i < len; i++) {
+		out[i] = gain * in[i];
+	}
+}
+
+#define SHARED_KERNELS \
+	.s24_to_float   = s24_to_float_scalar, \
+	.s32_to_float   = s32_to_float_scalar, \
+	.float_to_float = float_to_float_scalar, \
+	.float_to_s16   = float_to_s16_scalar, \
+	.float_to_s32   = float_to_s32_scalar
+
+#ifdef HAVE_NEON
+static void s16_to_float_neon(const int16_t *in, float *out, size_t len, float gain)
+{
+	const float scale = gain * S16_SCALE;
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		int16x8_t s = vld1q_s16(in + i);
+		float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(s)));
+		float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(s)));
+		vst1q_f32(out + i,     vmulq_n_f32(lo, scale));
+		vst1q_f32(out + i + 4, vmulq_n_f32(hi, scale));
+	}
+	s16_to_float_scalar(in + i, out + i, len - i, gain);
+}
+#endif
+
+#ifdef HAVE_SSE2
+static void s16_to_float_sse2(const int16_t *in, float *out, size_t len, float gain)
+{
+	const float scale = gain * S16_SCALE;
+	const __m128 vscale = _mm_set1_ps(scale);
+	size_t i = 0;
+
+	for (; i + 8 <= len; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(in + i));
+		// sign extend by putting each sample in the top half of a 32 bit lane
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+		_mm_storeu_ps(out + i,     _mm_mul_ps(_mm_cvtepi32_ps(lo), vscale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), vscale));
+	}
+	s16_to_float_scalar(in + i, out + i, len - i, gain);
+}
+#endif
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+static void s16_to_float_avx2(const int16_t *in, float *out, size_t len, float gain)
+{
+	const float scale = gain * S16_SCALE;
+	const __m256 vscale = _mm256_set1_ps(scale);
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(in + i + 8)));
+		_mm256_storeu_ps(out + i,     _mm256_mul_ps(_mm256_cvtepi32_ps(lo), vscale));
+		_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), vscale));
+	}
+	s16_to_float_scalar(in + i, out + i, len - i, gain);
+}
+#endif
+
+static const sample_kernels_t scalar_kernels = {
+	.name         = "scalar",
+	.s16_to_float = s16_to_float_scalar,
+	SHARED_KERNELS
+};
+
+#ifdef HAVE_NEON
+static const sample_kernels_t neon_kernels = {
+	.name         = "neon",
+	.s16_to_float = s16_to_float_neon,
+	SHARED_KERNELS
+};
+#endif
+
+#ifdef HAVE_SSE2
+static const sample_kernels_t sse2_kernels = {
+	.name         = "sse2",
+	.s16_to_float = s16_to_float_sse2,
+	SHARED_KERNELS
+};
+#endif
+
+#ifdef HAVE_AVX2
+static const sample_kernels_t avx2_kernels = {
+	.name         = "avx2",
+	.s16_to_float = s16_to_float_avx2,
+	SHARED_KERNELS
+};
+#endif
+
+int sample_kernels_available(const sample_kernels_t **kernels, int max)
+{
+	int n = 0;
+
+#ifdef HAVE_AVX2
+	__builtin_cpu_init();
+	if (n < max && __builtin_cpu_supports("avx2")) { kernels[n++] = &avx2_kernels; }
+#endif
+#ifdef HAVE_SSE2
+	if (n < max) { kernels[n++] = &sse2_kernels; }
+#endif
+#ifdef HAVE_NEON
+	if (n < max) { kernels[n++] = &neon_kernels; }
+#endif
+	if (n < max) { kernels[n++] = &scalar_kernels; }
+
+	return n;
+}
+
+const sample_kernels_t *sample_kernels(void)
+{
+	const sample_kernels_t *best[1];
+	sample_kernels_available(best, 1);
+	return best[0];
+}
+
+const sample_kernels_t *sample_kernels_scalar(void)
+{
+	return &scalar_kernels;
+}
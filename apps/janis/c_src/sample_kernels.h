@@ -0,0 +1,27 @@
+#include <stddef.h>
+#include <stdint.h>
+
+// Vectorised versions of the per-sample loops. Which versions exist is
+// decided at build time (NEON on ARM, SSE2 on x86) and, where the compiler
+// can build them, wider versions (AVX2) are picked at load time if the CPU
+// supports them. The scalar versions are always available & are the
+// reference the others are tested against.
+typedef struct {
+	const char *name;
+	// the incoming audio to float, out[i] = gain * (in[i] / full scale).
+	// 24 bit samples are packed little endian in 3 bytes.
+	void (*s16_to_float)(const int16_t *in, float *out, size_t len, float gain);
+	void (*s24_to_float)(const uint8_t *in, float *out, size_t len, float gain);
+	void (*s32_to_float)(const int32_t *in, float *out, size_t len, float gain);
+	// float to the output's format, out[i] = gain * in[i]. The integer
+	// versions clip anything outside [-1, 1).
+	void (*float_to_float)(const float *in, float *out, size_t len, float gain);
+	void (*float_to_s16)(const float *in, int16_t *out, size_t len, float gain);
+	void (*float_to_s32)(const float *in, int32_t *out, size_t len, float gain);
+} sample_kernels_t;
+
+// the fastest kernels supported by this cpu
+const sample_kernels_t *sample_kernels(void);
+const sample_kernels_t *sample_kernels_scalar(void);
+// all the kernels usable on this cpu, for testing
+int sample_kernels_available(const sample_kernels_t **kernels, int max);
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#endif
+
+#include "endian.h"
+#include "monotonic_time.h"
+#include "sntp.h"
+
+#define CONTROL_SIZE (256)
+
+// The kernel's timestamps are CLOCK_REALTIME so we convert them using the
+// current offset between that & the monotonic clock. The timestamps are at
+// most a few ms old so the chances of NTP stepping the clock in between are
+// slim.
+static int64_t realtime_to_monotonic_us(const struct timespec *ts)
+{
+	struct timespec realtime;
+	uint64_t before = monotonic_nanoseconds();
+	clock_gettime(CLOCK_REALTIME, &realtime);
+	uint64_t after  = monotonic_nanoseconds();
+
+	int64_t now_ns    = (int64_t)realtime.tv_sec * 1000000000LL + realtime.tv_nsec;
+	int64_t offset_ns = now_ns - (int64_t)(before + (after - before) / 2);
+	int64_t stamp_ns  = (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+
+	return (stamp_ns - offset_ns) / 1000;
+}
+
+// finds the kernel's software timestamp amongst a message's control data
+static bool kernel_timestamp(struct msghdr *msg, struct timespec *ts)
+{
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET) { continue; }
+#ifdef SO_TIMESTAMPING
+		if (cmsg->cmsg_type == SCM_TIMESTAMPING) {
+			// software, deprecated & hardware
+			struct timespec stamps[3];
+			memcpy(stamps, CMSG_DATA(cmsg), sizeof(stamps));
+			if (stamps[0].tv_sec != 0 || stamps[0].tv_nsec != 0) {
+				*ts = stamps[0];
+				return true;
+			}
+		}
+#endif
+#ifdef SO_TIMESTAMPNS
+		if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(ts, CMSG_DATA(cmsg), sizeof(struct timespec));
+			return true;
+		}
+#endif
+	}
+	return false;
+}
+
+// Empties the error queue of the transmit timestamps the kernel's queued up
+// for us. Each comes with the request it's for, after the headers, so
+// stamps for earlier requests are dropped. Returns true if there was one for
+// the request in flight, with the most recent in `originate`.
+static bool read_tx_timestamps(sntp_client_t *client, int64_t *originate)
+{
+	bool found = false;
+
+#ifdef SO_TIMESTAMPING
+	// room for the headers down to the link layer, which come back too
+	char packet[SNTP_REQUEST_SIZE + 128];
+	char control[CONTROL_SIZE];
+	struct iovec iov = { packet, sizeof(packet) };
+	struct msghdr msg;
+	struct timespec ts;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t len = recvmsg(client->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT);
+
+		if (len < 0) { break; }
+		if (len < SNTP_REQUEST_SIZE || (msg.msg_flags & MSG_TRUNC)) { continue; }
+
+		uint64_t count;
+		memcpy(&count, packet + len - SNTP_REQUEST_SIZE, 8);
+
+		if (le64toh(count) == client->count && kernel_timestamp(&msg, &ts)) {
+			*originate = realtime_to_monotonic_us(&ts);
+			found = true;
+		}
+	}
+#else
+	(void)client;
+	(void)originate;
+#endif
+	return found;
+}
+
+int sntp_open(sntp_client_t *client)
+{
+	client->kernel_tx = false;
+	client->kernel_rx = false;
+	client->count     = 0;
+	client->originate = 0;
+
+	client->fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (client->fd < 0) { return -1; }
+
+	if (fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK) < 0) {
+		sntp_close(client);
+		return -1;
+	}
+
+#ifdef SO_TIMESTAMPING
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+	if (setsockopt(client->fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+		client->kernel_tx = true;
+		client->kernel_rx = true;
+	}
+#endif
+#ifdef SO_TIMESTAMPNS
+	int on = 1;
+	if (!client->kernel_rx && setsockopt(client->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0) {
+		client->kernel_rx = true;
+	}
+#endif
+
+	return client->fd;
+}
+
+void sntp_close(sntp_client_t *client)
+{
+	if (client->fd >= 0) {
+		close(client->fd);
+		client->fd = -1;
+	}
+}
+
+int sntp_send(sntp_client_t *client, uint32_t address, uint16_t port, uint64_t count)
+{
+	char packet[SNTP_REQUEST_SIZE];
+	struct sockaddr_in to;
+
+	memset(&to, 0, sizeof(to));
+	to.sin_family      = AF_INET;
+	to.sin_addr.s_addr = address;
+	to.sin_port        = port;
+
+	int64_t  originate = (int64_t)monotonic_microseconds();
+	uint64_t le_count  = htole64(count);
+	uint64_t le_time   = htole64((uint64_t)originate);
+
+	memcpy(packet, &le_count, 8);
+	memcpy(packet + 8, &le_time, 8);
+
+	if (sendto(client->fd, packet, sizeof(packet), 0, (struct sockaddr *)&to, sizeof(to)) != sizeof(packet)) {
+		return -1;
+	}
+
+	client->count     = count;
+	client->originate = originate;
+
+	// software timestamps are usually there by the time sendto returns
+	if (client->kernel_tx) {
+		read_tx_timestamps(client, &client->originate);
+	}
+	return 0;
+}
+
+bool sntp_receive(sntp_client_t *client, sntp_exchange_t *exchange)
+{
+	char packet[SNTP_REPLY_SIZE];
+	char control[CONTROL_SIZE];
+	struct iovec iov = { packet, sizeof(packet) };
+	struct msghdr msg;
+	struct timespec ts;
+
+	// A queued timestamp makes the socket poll as in error, so we're called
+	// whether or not there's a reply. If the reply's been lost, or is for
+	// another request, nothing else would empty the queue & the VM would
+	// keep calling us until the next request went out.
+	if (client->kernel_tx) {
+		read_tx_timestamps(client, &client->originate);
+	}
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov        = &iov;
+		msg.msg_iovlen     = 1;
+		msg.msg_control    = control;
+		msg.msg_controllen = sizeof(control);
+
+		ssize_t len = recvmsg(client->fd, &msg, MSG_DONTWAIT);
+		int64_t now = (int64_t)monotonic_microseconds();
+
+		if (len < 0) { return false; }
+		if (len != SNTP_REPLY_SIZE) { continue; }
+
+		uint64_t count, receipt, reply;
+		memcpy(&count, packet, 8);
+		memcpy(&receipt, packet + 16, 8);
+		memcpy(&reply, packet + 24, 8);
+
+		// a late reply to a request that's been given up on
+		if (le64toh(count) != client->count) { continue; }
+
+		if (client->kernel_tx) {
+			read_tx_timestamps(client, &client->originate);
+		}
+
+		exchange->count     = client->count;
+		exchange->originate = client->originate;
+		exchange->receipt   = (int64_t)le64toh(receipt);
+		exchange->reply     = (int64_t)le64toh(reply);
+		exchange->finish    = (client->kernel_rx && kernel_timestamp(&msg, &ts)) ? realtime_to_monotonic_us(&ts) : now;
+		return true;
+	}
+}
@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+// The receiver's half of the time sync exchange with the broadcaster.
+//
+// Timing the exchange from Erlang means the send & receive times include
+// however long the VM took to get round to us, which shows up as network
+// latency & noise in the delta. Instead we keep one socket open for the life
+// of the driver & have the kernel timestamp the request as it leaves & the
+// reply as it arrives (SO_TIMESTAMPING, or SO_TIMESTAMPNS for just the reply
+// where that's all there is) falling back to reading the clock ourselves
+// around the syscalls.
+//
+// Requests are the sequence number & originate time, both 64 bit little
+// endian; replies echo those & add the broadcaster's receipt & reply times.
+// All times are monotonic µs on our side.
+
+#define SNTP_REQUEST_SIZE (16)
+#define SNTP_REPLY_SIZE   (32)
+
+typedef struct {
+	uint64_t count;
+	int64_t  originate; // when the request left
+	int64_t  receipt;   // broadcaster's clock
+	int64_t  reply;     // broadcaster's clock
+	int64_t  finish;    // when the reply arrived
+} sntp_exchange_t;
+
+typedef struct {
+	int      fd;
+	// which timestamps the kernel's giving us
+	bool     kernel_tx;
+	bool     kernel_rx;
+	// the request in flight & when it left, in case the kernel's timestamp
+	// for it turns up after the reply
+	uint64_t count;
+	int64_t  originate;
+} sntp_client_t;
+
+// returns the socket or -1, setting errno
+int  sntp_open(sntp_client_t *client);
+void sntp_close(sntp_client_t *client);
+
+// `address` & `port` are in network byte order. Returns 0 or -1, setting
+// errno.
+int  sntp_send(sntp_client_t *client, uint32_t address, uint16_t port, uint64_t count);
+
+// reads a waiting reply without blocking. Returns true if there was one &
+// it was a reply to the request in flight.
+bool sntp_receive(sntp_client_t *client, sntp_exchange_t *exchange);
@@ -0,0 +1,109 @@
+// Checks that the jitter buffer puts chunks back in order, spots duplicates,
+// late arrivals & gaps, & copes with running out of slots.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+
+#include "../jitter_buffer.h"
+
+#define CHUNK_US     (10000)
+#define TOLERANCE_US (CHUNK_US / 2)
+
+static int failures = 0;
+static jitter_buffer_t jb;
+
+#define CHECK(condition, ...) \
+	if (!(condition)) { fprintf(stderr, "FAIL " __VA_ARGS__); fprintf(stderr, "\n"); failures++; }
+
+static int insert(uint64_t timestamp) {
+	return jitter_buffer_insert(&jb, timestamp, timestamp + CHUNK_US);
+}
+
+static void check_reordering(void) {
+	uint64_t arrivals[] = {0, 20000, 10000, 40000, 30000};
+	uint64_t expected   = 0;
+
+	jitter_buffer_init(&jb, TOLERANCE_US);
+
+	for (size_t i = 0; i < sizeof(arrivals) / sizeof(arrivals[0]); i++) {
+		CHECK(insert(arrivals[i]) >= 0, "insert %" PRIu64, arrivals[i]);
+	}
+	CHECK(jitter_buffer_span(&jb) == 50000, "span %" PRIu64, jitter_buffer_span(&jb));
+
+	while (jitter_buffer_peek(&jb) != NULL) {
+		const jitter_entry_t *entry = jitter_buffer_peek(&jb);
+		CHECK(entry->timestamp == expected, "order %" PRIu64 ", expected %" PRIu64, entry->timestamp, expected);
+		CHECK(jitter_buffer_gap(&jb) == 0, "gap %" PRIu64 " at %" PRIu64, jitter_buffer_gap(&jb), entry->timestamp);
+		jitter_buffer_commit(&jb);
+		expected += CHUNK_US;
+	}
+}
+
+static void check_duplicates_and_late(void) {
+	jitter_buffer_init(&jb, TOLERANCE_US);
+
+	insert(100000);
+	// the time delta moves timestamps about a bit
+	CHECK(insert(100003) == JITTER_DUPLICATE, "staged duplicate");
+	jitter_buffer_commit(&jb);
+
+	CHECK(insert(99998) == JITTER_LATE, "committed duplicate");
+	CHECK(insert(100004) == JITTER_DUPLICATE, "committed duplicate ending after it");
+	CHECK(insert(50000) == JITTER_LATE, "late");
+	CHECK(insert(110002) >= 0, "next chunk");
+}
+
+// a packet's last chunk is whatever's left over, so the next packet's
+// first chunk can start well within the tolerance of it
+static void check_short_chunk(void) {
+	jitter_buffer_init(&jb, TOLERANCE_US);
+
+	CHECK(jitter_buffer_insert(&jb, 0, 3000) >= 0, "short chunk");
+	CHECK(jitter_buffer_insert(&jb, 3000, 13000) >= 0, "chunk after a short one");
+	CHECK(jitter_buffer_insert(&jb, 3002, 13002) == JITTER_DUPLICATE, "duplicate after a short chunk");
+	jitter_buffer_commit(&jb);
+	CHECK(jitter_buffer_gap(&jb) == 0, "gap %" PRIu64, jitter_buffer_gap(&jb));
+	jitter_buffer_commit(&jb);
+
+	CHECK(jitter_buffer_insert(&jb, 13000, 16000) >= 0, "short chunk after committing");
+	jitter_buffer_commit(&jb);
+	CHECK(jitter_buffer_insert(&jb, 16000, 26000) >= 0, "chunk after a committed short one");
+	CHECK(jitter_buffer_insert(&jb, 12000, 15000) == JITTER_LATE, "late short chunk");
+}
+
+static void check_gaps(void) {
+	jitter_buffer_init(&jb, TOLERANCE_US);
+
+	insert(0);
+	CHECK(jitter_buffer_gap(&jb) == 0, "nothing committed");
+	jitter_buffer_commit(&jb);
+
+	insert(35000);
+	CHECK(jitter_buffer_gap(&jb) == 25000, "gap %" PRIu64, jitter_buffer_gap(&jb));
+}
+
+static void check_full(void) {
+	jitter_buffer_init(&jb, TOLERANCE_US);
+
+	for (int i = 0; i < JITTER_SLOTS; i++) {
+		insert((uint64_t)i * CHUNK_US);
+	}
+	CHECK(insert((uint64_t)JITTER_SLOTS * CHUNK_US) == JITTER_FULL, "full");
+
+	jitter_buffer_commit(&jb);
+	CHECK(insert((uint64_t)JITTER_SLOTS * CHUNK_US) >= 0, "slot freed");
+
+	jitter_buffer_reset(&jb);
+	CHECK(jitter_buffer_peek(&jb) == NULL && insert(0) >= 0, "reset");
+}
+
+int main(void) {
+	check_reordering();
+	check_duplicates_and_late();
+	check_short_chunk();
+	check_gaps();
+	check_full();
+	printf("jitter   %s\n", failures ? "FAIL" : "ok");
+	return failures ? 1 : 0;
+}
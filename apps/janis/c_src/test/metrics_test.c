@@ -0,0 +1,107 @@
+// Checks the metrics histograms & that a reader racing the audio thread's
+// writes always gets a consistent copy of the block.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+
+#include "../metrics.h"
+
+#define PUBLISH_COUNT (200000)
+
+static int failures = 0;
+static metrics_block_t block;
+
+static void *writer(void *arg) {
+	metrics_callback_t callback;
+
+	(void)arg;
+	memset(&callback, 0, sizeof(callback));
+
+	for (long i = 0; i < PUBLISH_COUNT; i++) {
+		callback.measured    = true;
+		callback.offset_us   = (i % 200) - 100;
+		callback.fill_ms     = (i % 32) * 10;
+		callback.duration_ns = (uint64_t)(i % 5000);
+		metrics_publish(&block, &callback);
+	}
+	return NULL;
+}
+
+static uint64_t sum(const uint32_t *buckets, int count) {
+	uint64_t total = 0;
+	for (int i = 0; i < count; i++) { total += buckets[i]; }
+	return total;
+}
+
+static void check_consistent_reads(void) {
+	pthread_t thread;
+	metrics_t metrics;
+	long reads = 0;
+
+	metrics_init(&block);
+	pthread_create(&thread, NULL, writer, NULL);
+
+	do {
+		metrics_read(&block, &metrics);
+		reads++;
+
+		if (sum(metrics.fill, METRICS_FILL_BUCKETS) != metrics.callbacks ||
+				sum(metrics.offset, METRICS_OFFSET_BUCKETS) != metrics.callbacks ||
+				sum(metrics.duration, METRICS_DURATION_BUCKETS) != metrics.callbacks) {
+			fprintf(stderr, "FAIL torn read after %ld reads: %" PRIu64 " callbacks\n", reads, metrics.callbacks);
+			failures++;
+			break;
+		}
+	} while (metrics.callbacks < PUBLISH_COUNT);
+
+	pthread_join(thread, NULL);
+}
+
+static void check_percentiles(void) {
+	metrics_callback_t callback;
+	metrics_t metrics;
+
+	memset(&callback, 0, sizeof(callback));
+	metrics_init(&block);
+
+	// offsets of -500..499µs & durations of 1000ns
+	for (int i = 0; i < 1000; i++) {
+		callback.measured    = true;
+		callback.offset_us   = i - 500;
+		callback.duration_ns = 1000;
+		metrics_publish(&block, &callback);
+	}
+	metrics_read(&block, &metrics);
+
+	int64_t p1  = metrics_offset_percentile(&metrics, 0.01);
+	int64_t p50 = metrics_offset_percentile(&metrics, 0.5);
+	int64_t p99 = metrics_offset_percentile(&metrics, 0.99);
+
+	if (p1 != -500 || p50 != 0 || p99 != 480) {
+		fprintf(stderr, "FAIL offset percentiles %" PRIi64 " %" PRIi64 " %" PRIi64 "\n", p1, p50, p99);
+		failures++;
+	}
+	if (metrics_duration_percentile(&metrics, 0.5) != 1024 || metrics.callback_ns_max != 1000) {
+		fprintf(stderr, "FAIL duration percentile %" PRIu64 "\n", metrics_duration_percentile(&metrics, 0.5));
+		failures++;
+	}
+
+	metrics_request_reset(&block);
+	metrics_publish(&block, &callback);
+	metrics_read(&block, &metrics);
+
+	if (metrics.callbacks != 1) {
+		fprintf(stderr, "FAIL reset left %" PRIu64 " callbacks\n", metrics.callbacks);
+		failures++;
+	}
+}
+
+int main(void) {
+	check_percentiles();
+	check_consistent_reads();
+	printf("metrics  %s\n", failures ? "FAIL" : "ok");
+	return failures ? 1 : 0;
+}
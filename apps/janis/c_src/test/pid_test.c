@@ -0,0 +1,134 @@
+// Checks the sync loop's controller: the gain schedule, the output limit &
+// anti-windup, feed-forward & auto-tune, & the DAC drift estimator.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../pid.h"
+#include "../drift_estimator.h"
+
+#define PERIOD       (0.005)
+#define LIMIT        (0.01)
+#define SAMPLE_RATE  (44100.0)
+
+static int failures = 0;
+static pid_state_t pid;
+
+#define CHECK(condition, ...) \
+	if (!(condition)) { fprintf(stderr, "FAIL " __VA_ARGS__); fprintf(stderr, "\n"); failures++; }
+
+static void init(double fine_ki) {
+	pid_gains_t fine   = { 2.0, fine_ki, 0.0 };
+	pid_gains_t coarse = { 8.0, 0.0, 0.0 };
+	pid_init(&pid, fine, coarse, 50.0, 500.0, LIMIT, 1.0);
+}
+
+// uniform in [-0.5, 0.5)
+static double noise(uint64_t *state) {
+	*state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+	return (double)(*state >> 11) / (double)(1ULL << 53) - 0.5;
+}
+
+static void check_schedule(void) {
+	init(0.1);
+	pid_control(&pid, 1.0, 0.0, 0.0);
+
+	pid_control(&pid, 1.0 + PERIOD, -10.0, 0.0);
+	CHECK(pid.gains.kp == 2.0 && pid.gains.ki == 0.1, "fine gains %f %f", pid.gains.kp, pid.gains.ki);
+
+	pid_control(&pid, 1.0 + 2 * PERIOD, -275.0, 0.0);
+	CHECK(pid.gains.kp == 5.0, "interpolated kp %f", pid.gains.kp);
+	CHECK(pid.gains.ki > 0.0 && pid.gains.ki < 0.05, "integral fades out first %f", pid.gains.ki);
+
+	pid_control(&pid, 1.0 + 3 * PERIOD, 3000.0, 0.0);
+	CHECK(pid.gains.kp == 8.0 && pid.gains.ki == 0.0, "coarse gains %f %f", pid.gains.kp, pid.gains.ki);
+}
+
+static void check_limit_and_windup(void) {
+	double t = 1.0;
+	double output = 0.0;
+
+	init(50.0);
+	pid_control(&pid, t, 0.0, 0.0);
+
+	// small enough to be in the fine band but big enough, with the integral,
+	// to hold the output at the limit for a long time
+	for (int i = 0; i < 2000; i++) {
+		t += PERIOD;
+		output = pid_control(&pid, t, -40.0, 0.0);
+	}
+	CHECK(output == LIMIT, "limited %f", output);
+	// left alone the integral would be at 20000ppm by now. Backing it off
+	// over the tracking time holds it at the limit plus ki * error * 1s.
+	CHECK(pid.i < LIMIT * 1e6 + 50.0 * 40.0 + 1.0, "integral %f wound up", pid.i);
+
+	// so once the error changes sign there's less to unwind
+	for (int i = 0; i < 1500; i++) {
+		t += PERIOD;
+		output = pid_control(&pid, t, 40.0, 0.0);
+	}
+	CHECK(output < 0.0, "recovered %f", output);
+}
+
+static void check_feed_forward(void) {
+	init(0.1);
+	pid_set_feed_forward(&pid, -50e-6);
+	pid_control(&pid, 1.0, 0.0, 0.0);
+
+	double output = pid_control(&pid, 1.0 + PERIOD, 0.0, 0.0);
+	CHECK(fabs(output + 50e-6) < 1e-12, "feed-forward %g", output);
+}
+
+static void check_autotune(void) {
+	uint64_t state = 1;
+	double t = 1.0;
+
+	init(0.1);
+	pid_autotune_start(&pid, 2.0, 100.0);
+
+	// 200µs of uniform noise, σ ≈ 58µs, on a slowly shrinking error
+	for (int i = 0; i < 1000 && !pid_autotune_finished(&pid); i++) {
+		pid_control(&pid, t, 500.0 * exp(-(t - 1.0)) + 200.0 * noise(&state), 0.0);
+		t += PERIOD;
+	}
+	CHECK(!pid.autotune.active, "tuning finished");
+	CHECK(fabs(pid.autotune.period - PERIOD) < 1e-9, "period %f", pid.autotune.period);
+	CHECK(fabs(pid.autotune.noise - 57.7) < 6.0, "noise %f", pid.autotune.noise);
+	CHECK(fabs(pid.fine.kp - 100.0 / pid.autotune.noise) < 1e-9, "kp %f", pid.fine.kp);
+	CHECK(fabs(pid.fine.ki - pid.fine.kp * pid.fine.kp / 4.0) < 1e-9, "ki %f", pid.fine.ki);
+	CHECK(pid.fine.kd == 0.0, "kd %f", pid.fine.kd);
+}
+
+static void check_drift(void) {
+	drift_estimator_t drift;
+	uint64_t state = 7;
+	uint64_t frames = 0;
+	double rate = SAMPLE_RATE * (1.0 + 50e-6);
+
+	drift_estimator_init(&drift, SAMPLE_RATE, 20.0, 2.0);
+
+	// an hour in, with each DAC time up to 500µs late
+	for (int i = 0; i < 60 * 1000; i++) {
+		bool valid = drift_estimator_update(&drift, frames, 3600.0 + (double)frames / rate + 0.0005 * (noise(&state) + 0.5));
+		if (i == 100) {
+			CHECK(!valid, "no estimate before min_seconds");
+		}
+		frames += 256;
+	}
+	CHECK(drift.valid && fabs(drift.drift - 50e-6) < 3e-6, "drift %.2fppm", drift.drift * 1e6);
+
+	drift_estimator_reset(&drift);
+	CHECK(!drift.valid, "reset");
+}
+
+int main(void) {
+	check_schedule();
+	check_limit_and_windup();
+	check_feed_forward();
+	check_autotune();
+	check_drift();
+	printf("pid      %s\n", failures ? "FAIL" : "ok");
+	return failures ? 1 : 0;
+}
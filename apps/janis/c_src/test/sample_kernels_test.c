@@ -0,0 +1,196 @@
+// Checks every set of sample kernels usable on this cpu against the scalar
+// versions, including lengths that don't fill a vector and unaligned
+// buffers.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../sample_kernels.h"
+
+#define MAX_KERNELS (8)
+#define MAX_LEN     (1764 + 3)
+
+static int failures = 0;
+
+static void check_s16_to_float(const sample_kernels_t *kernels, const int16_t *in, size_t len, float gain)
+{
+	static float expected[MAX_LEN], actual[MAX_LEN];
+
+	sample_kernels_scalar()->s16_to_float(in, expected, len, gain);
+	kernels->s16_to_float(in, actual, len, gain);
+
+	for (size_t i = 0; i < len; i++) {
+		if (expected[i] != actual[i]) {
+			fprintf(stderr, "FAIL %s s16_to_float len=%zu gain=%f [%zu]: %d -> %.9g, expected %.9g\n",
+					kernels->name, len, gain, i, in[i], actual[i], expected[i]);
+			failures++;
+			return;
+		}
+	}
+}
+
+// 24 & 32 bit samples are exactly their value over the full scale, times
+// the gain
+static void check_s24_to_float(const sample_kernels_t *kernels, const int32_t *in, size_t len, float gain)
+{
+	static uint8_t packed[MAX_LEN * 3];
+	static float   actual[MAX_LEN];
+
+	for (size_t i = 0; i < len; i++) {
+		int32_t s = in[i] >> 8;
+		packed[i * 3]     = (uint8_t)(s & 0xff);
+		packed[i * 3 + 1] = (uint8_t)((s >> 8) & 0xff);
+		packed[i * 3 + 2] = (uint8_t)((s >> 16) & 0xff);
+	}
+	kernels->s24_to_float(packed, actual, len, gain);
+
+	for (size_t i = 0; i < len; i++) {
+		float expected = gain * ((float)(in[i] >> 8) / 8388608.0f);
+		if (actual[i] != expected) {
+			fprintf(stderr, "FAIL %s s24_to_float gain=%f [%zu]: %d -> %.9g, expected %.9g\n",
+					kernels->name, gain, i, in[i] >> 8, actual[i], expected);
+			failures++;
+			return;
+		}
+	}
+}
+
+static void check_s32_to_float(const sample_kernels_t *kernels, const int32_t *in, size_t len, float gain)
+{
+	static float actual[MAX_LEN];
+
+	kernels->s32_to_float(in, actual, len, gain);
+
+	for (size_t i = 0; i < len; i++) {
+		float expected = gain * ((float)in[i] / 2147483648.0f);
+		if (actual[i] != expected) {
+			fprintf(stderr, "FAIL %s s32_to_float gain=%f [%zu]: %d -> %.9g, expected %.9g\n",
+					kernels->name, gain, i, in[i], actual[i], expected);
+			failures++;
+			return;
+		}
+	}
+}
+
+// converting to float & back again should be lossless
+static void check_float_round_trip(const sample_kernels_t *kernels, const int16_t *in, const int32_t *in32, size_t len)
+{
+	static float   f[MAX_LEN];
+	static int16_t s16[MAX_LEN];
+	static int32_t s32[MAX_LEN];
+
+	kernels->s16_to_float(in, f, len, 1.0f);
+	kernels->float_to_s16(f, s16, len, 1.0f);
+	kernels->float_to_s32(f, s32, len, 1.0f);
+
+	for (size_t i = 0; i < len; i++) {
+		if (s16[i] != in[i] || s32[i] != (int32_t)in[i] * 65536) {
+			fprintf(stderr, "FAIL %s float round trip [%zu]: %d -> %d / %d\n", kernels->name, i, in[i], s16[i], s32[i]);
+			failures++;
+			return;
+		}
+	}
+
+	// 24 bits fit in a float's mantissa
+	for (size_t i = 0; i < len; i++) {
+		s32[i] = in32[i] & ~0xff;
+	}
+	kernels->s32_to_float(s32, f, len, 1.0f);
+	kernels->float_to_s32(f, s32, len, 1.0f);
+
+	for (size_t i = 0; i < len; i++) {
+		if (s32[i] != (in32[i] & ~0xff)) {
+			fprintf(stderr, "FAIL %s 24 bit round trip [%zu]: %d -> %d\n", kernels->name, i, in32[i] & ~0xff, s32[i]);
+			failures++;
+			return;
+		}
+	}
+}
+
+static void check_float_gain(const sample_kernels_t *kernels)
+{
+	const float in[2] = { 0.5f, -0.25f };
+	float   f[2];
+	int16_t s16[2];
+	int32_t s32[2];
+
+	kernels->float_to_float(in, f, 2, 0.5f);
+	kernels->float_to_s16(in, s16, 2, 0.5f);
+	kernels->float_to_s32(in, s32, 2, 0.5f);
+
+	if (f[0] != 0.25f || f[1] != -0.125f || s16[0] != 8192 || s16[1] != -4096 ||
+			s32[0] != (1 << 29) || s32[1] != -(1 << 28)) {
+		fprintf(stderr, "FAIL %s float gain\n", kernels->name);
+		failures++;
+	}
+}
+
+static void check_float_clipping(const sample_kernels_t *kernels)
+{
+	const float in[4] = { 1.5f, -1.5f, 1.0f, -1.0f };
+	int16_t s16[4];
+	int32_t s32[4];
+
+	kernels->float_to_s16(in, s16, 4, 1.0f);
+	kernels->float_to_s32(in, s32, 4, 1.0f);
+
+	if (s16[0] != INT16_MAX || s16[1] != INT16_MIN || s16[2] != INT16_MAX || s16[3] != INT16_MIN ||
+			s32[0] != INT32_MAX || s32[1] != INT32_MIN || s32[2] != INT32_MAX || s32[3] != INT32_MIN) {
+		fprintf(stderr, "FAIL %s float clipping\n", kernels->name);
+		failures++;
+	}
+}
+
+int main(void)
+{
+	const sample_kernels_t *kernels[MAX_KERNELS];
+	const float gains[] = { 1.0f, 0.5f, 0.123f, 0.0f };
+	static int16_t samples[MAX_LEN + 1];
+	static int32_t samples32[MAX_LEN];
+
+	srand(1);
+	for (size_t i = 0; i < MAX_LEN + 1; i++) {
+		samples[i] = (int16_t)((rand() & 0xffff) - 0x8000);
+	}
+	for (size_t i = 0; i < MAX_LEN; i++) {
+		samples32[i] = (int32_t)(((uint32_t)rand() << 16) ^ (uint32_t)rand());
+	}
+	// make sure the extremes are in there
+	samples[0] = INT16_MIN;
+	samples[1] = INT16_MAX;
+	samples32[0] = INT32_MIN;
+	samples32[1] = INT32_MAX;
+
+	int count = sample_kernels_available(kernels, MAX_KERNELS);
+
+	for (int k = 0; k < count; k++) {
+		for (size_t g = 0; g < sizeof(gains) / sizeof(float); g++) {
+			for (size_t len = 0; len <= 67; len++) {
+				check_s16_to_float(kernels[k], samples, len, gains[g]);
+				check_s16_to_float(kernels[k], samples + 1, len, gains[g]);
+			}
+			check_s16_to_float(kernels[k], samples, MAX_LEN, gains[g]);
+			check_s24_to_float(kernels[k], samples32, MAX_LEN, gains[g]);
+			check_s32_to_float(kernels[k], samples32, MAX_LEN, gains[g]);
+		}
+		check_float_round_trip(kernels[k], samples, samples32, MAX_LEN);
+		check_float_gain(kernels[k]);
+		check_float_clipping(kernels[k]);
+		printf("%-8s %s\n", kernels[k]->name, failures ? "FAIL" : "ok");
+	}
+
+	// the fused conversion must match converting then scaling, as the driver
+	// used to do
+	for (size_t i = 0; i < MAX_LEN; i++) {
+		float out;
+		sample_kernels()->s16_to_float(samples + i, &out, 1, 0.123f);
+		if (out != 0.123f * (float)(samples[i] / (1.0 * 0x8000))) {
+			fprintf(stderr, "FAIL fused conversion differs for %d\n", samples[i]);
+			failures++;
+			break;
+		}
+	}
+
+	return failures ? 1 : 0;
+}
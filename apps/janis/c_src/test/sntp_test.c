@@ -0,0 +1,136 @@
+// Checks the time sync exchange against a broadcaster on loopback, & that
+// a lost or stale reply doesn't leave the socket polling as ready, which
+// would have the VM call ready_input over & over.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "../endian.h"
+#include "../sntp.h"
+
+static int failures = 0;
+static sntp_client_t client;
+static int broadcaster = -1;
+static struct sockaddr_in address;
+
+#define CHECK(condition, ...) \
+	if (!(condition)) { fprintf(stderr, "FAIL " __VA_ARGS__); fprintf(stderr, "\n"); failures++; }
+
+// no events waiting, as poll would tell the VM
+static bool quiet(void) {
+	struct pollfd fd = { client.fd, POLLIN, 0 };
+	return poll(&fd, 1, 0) == 0;
+}
+
+// waits for the request & replies to it as `count`, or not at all if
+// `count` is 0
+static void reply(uint64_t count) {
+	char request[SNTP_REQUEST_SIZE];
+	char packet[SNTP_REPLY_SIZE];
+	struct sockaddr_in from;
+	socklen_t from_len = sizeof(from);
+
+	if (recvfrom(broadcaster, request, sizeof(request), 0, (struct sockaddr *)&from, &from_len) != SNTP_REQUEST_SIZE) {
+		CHECK(false, "no request");
+		return;
+	}
+	if (count == 0) { return; }
+
+	uint64_t le_count = htole64(count);
+	uint64_t times    = htole64(1000);
+
+	memcpy(packet, &le_count, 8);
+	memcpy(packet + 8, request + 8, 8);
+	memcpy(packet + 16, &times, 8);
+	memcpy(packet + 24, &times, 8);
+	sendto(broadcaster, packet, sizeof(packet), 0, (struct sockaddr *)&from, from_len);
+}
+
+// lets the kernel deliver what's been sent over loopback
+static void settle(void) {
+	struct pollfd fd = { client.fd, POLLIN, 50 };
+	poll(&fd, 1, 50);
+}
+
+static void check_exchange(void) {
+	sntp_exchange_t exchange;
+
+	sntp_send(&client, address.sin_addr.s_addr, address.sin_port, 1);
+	reply(1);
+	settle();
+
+	CHECK(sntp_receive(&client, &exchange), "no reply");
+	CHECK(exchange.count == 1 && exchange.receipt == 1000, "reply %llu", (unsigned long long)exchange.count);
+	CHECK(exchange.finish >= exchange.originate, "finish %lld before originate %lld", (long long)exchange.finish, (long long)exchange.originate);
+	CHECK(quiet(), "socket still ready after the reply");
+}
+
+// a request sent behind sntp_send's back, so its transmit timestamp is
+// still queued when sntp_send returns, as it would be if the kernel had
+// been slow to timestamp the real one
+static void send_unread(uint64_t count) {
+	char request[SNTP_REQUEST_SIZE];
+	uint64_t le_count = htole64(count);
+
+	memset(request, 0, sizeof(request));
+	memcpy(request, &le_count, 8);
+	sendto(client.fd, request, sizeof(request), 0, (struct sockaddr *)&address, sizeof(address));
+}
+
+static void check_lost_reply(void) {
+	sntp_exchange_t exchange;
+
+	sntp_send(&client, address.sin_addr.s_addr, address.sin_port, 2);
+	reply(0);
+	send_unread(2);
+	reply(0);
+	settle();
+
+	CHECK(!sntp_receive(&client, &exchange), "reply to a lost request");
+	CHECK(quiet(), "socket still ready after a lost reply");
+}
+
+static void check_stale_reply(void) {
+	sntp_exchange_t exchange;
+
+	sntp_send(&client, address.sin_addr.s_addr, address.sin_port, 3);
+	reply(2);
+	send_unread(3);
+	reply(0);
+	settle();
+
+	CHECK(!sntp_receive(&client, &exchange), "stale reply taken");
+	CHECK(quiet(), "socket still ready after a stale reply");
+}
+
+int main(void) {
+	socklen_t len = sizeof(address);
+
+	memset(&address, 0, sizeof(address));
+	address.sin_family      = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	broadcaster = socket(AF_INET, SOCK_DGRAM, 0);
+
+	if (broadcaster < 0 || bind(broadcaster, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+			getsockname(broadcaster, (struct sockaddr *)&address, &len) != 0 || sntp_open(&client) < 0) {
+		printf("sntp     skipped, no loopback\n");
+		return 0;
+	}
+
+	check_exchange();
+	check_lost_reply();
+	check_stale_reply();
+
+	sntp_close(&client);
+	close(broadcaster);
+
+	printf("sntp     %s\n", failures ? "FAIL" : "ok");
+	return failures ? 1 : 0;
+}
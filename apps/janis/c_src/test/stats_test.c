@@ -0,0 +1,67 @@
+// Checks that the STATS_COMMAND reply decodes: {ok, Map} with as many
+// keys as its map header claims & nothing left over.
+
+#include "../janis.h"
+
+// the emulator's default reply buffer
+#define REPLY_SIZE (64)
+
+extern ErlDrvEntry example_driver_entry;
+
+static int failures = 0;
+
+#define CHECK(condition, ...) \
+	if (!(condition)) { fprintf(stderr, "FAIL " __VA_ARGS__); fprintf(stderr, "\n"); failures++; }
+
+static bool has_key(char keys[][MAXATOMLEN], int count, const char *key) {
+	for (int i = 0; i < count; i++) {
+		if (strcmp(keys[i], key) == 0) { return true; }
+	}
+	return false;
+}
+
+static void check_reply(const char *rbuf, int len) {
+	char keys[64][MAXATOMLEN];
+	char atom[MAXATOMLEN];
+	int  index = 0, version, arity, count;
+
+	CHECK(ei_decode_version(rbuf, &index, &version) == 0, "version");
+	CHECK(ei_decode_tuple_header(rbuf, &index, &arity) == 0 && arity == 2, "{ok, stats}");
+	CHECK(ei_decode_atom(rbuf, &index, atom) == 0 && strcmp(atom, "ok") == 0, "ok");
+	if (failures) { return; }
+
+	CHECK(ei_decode_map_header(rbuf, &index, &count) == 0 && count <= 64, "map header");
+	if (failures) { return; }
+
+	for (int i = 0; i < count; i++) {
+		if (index >= len || ei_decode_atom(rbuf, &index, keys[i]) != 0) {
+			fprintf(stderr, "FAIL map header claims %d keys, found %d\n", count, i);
+			failures++;
+			return;
+		}
+		CHECK(!has_key(keys, i, keys[i]), "duplicate key %s", keys[i]);
+		CHECK(ei_skip_term(rbuf, &index) == 0 && index <= len, "value of %s", keys[i]);
+		if (failures) { return; }
+	}
+	CHECK(index == len, "%d bytes left after %d keys", len - index, count);
+
+	CHECK(has_key(keys, count, "callbacks"), "no callbacks");
+	CHECK(has_key(keys, count, "offset_us"), "no offset_us");
+	CHECK(has_key(keys, count, "buffer_fill"), "no buffer_fill");
+}
+
+int main(void) {
+	char  reply[REPLY_SIZE];
+	char *rbuf = reply;
+
+	ErlDrvData drv = example_driver_entry.start(NULL, "janis");
+
+	ErlDrvSSizeT len = example_driver_entry.control(drv, STATS_COMMAND, NULL, 0, &rbuf, sizeof(reply));
+	check_reply(rbuf, (int)len);
+
+	if (rbuf != reply) { driver_free(rbuf); }
+	example_driver_entry.stop(drv);
+
+	printf("stats    %s\n", failures ? "FAIL" : "ok");
+	return failures ? 1 : 0;
+}
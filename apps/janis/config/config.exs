@@ -30,8 +30,97 @@ config :logger, :console,
 #
 #     import_config "#{Mix.env}.exs"
 
+# The format of the audio the broadcaster sends, which the driver opens the
+# output stream with: 44100, 48000, 88200 or 96000Hz, 16, 24 or 32 bit little
+# endian samples (24 bit packed in 3 bytes) & 1 to 8 interleaved channels.
 config :janis, :sample_freq,     44100
 config :janis, :sample_bits,     16
 config :janis, :sample_channels, 2
 
+# What the driver plays the audio through. :portaudio goes through PortAudio's
+# default device. :alsa writes straight into the ALSA pcm :output_device's
+# mmap buffer ("" is "default") & times playback from the driver's own
+# timestamps. :null & :file keep time without a sound card, :file writing the
+# raw audio to the path in :output_device. With the last three
+# :frames_per_buffer is the period (0 is 256 frames) & :latency_ms the
+# buffer (0 is 4 periods).
+config :janis, :output_backend, :portaudio
+config :janis, :output_device,  ""
+# The sample format of the audio output stream: :float32, :int16 or :int32
+config :janis, :output_format,        :float32
+# How much audio the driver can buffer, in ms. Memory use goes up in
+# proportion (~350 bytes/ms at 44.1kHz stereo, more at higher rates & with
+# more channels) so deeper buffers for flaky wifi links are cheap.
+config :janis, :buffer_ms, 640
+# Who decides when packets are handed to the driver. :player queues them &
+# sends them on a timer just ahead of their play time. :driver sends them
+# on as soon as they arrive & lets the driver hold them until they're due,
+# which needs :buffer_ms to cover how far ahead the broadcaster sends.
+config :janis, :packet_scheduling, :player
+# The frames PortAudio hands the driver per callback. 0 lets PortAudio pick,
+# which may vary from callback to callback.
+config :janis, :frames_per_buffer, 0
+# The output latency asked of PortAudio in ms. 0 uses the device's default
+# low latency. Wifi receivers may want more headroom than wired ones. These,
+# & :buffer_ms, can be changed at runtime with Janis.Audio.configure/1.
+config :janis, :latency_ms, 0
+# What the driver does with audio that doesn't fit in its buffer. :reject drops
+# the new audio, :evict drops the oldest audio to make room for it.
+config :janis, :overflow, :reject
+# The fractions of the driver's buffer at which the player holds off sending
+# it audio & then starts again.
+config :janis, :high_watermark, 0.75
+config :janis, :low_watermark, 0.25
+# How long the driver holds on to a packet waiting for any earlier ones, e.g.
+# retransmissions after a wifi stall, to turn up. Packets that are nearly due
+# are played regardless. Duplicates & packets that turn up too late are
+# dropped & gaps are filled with silence.
+config :janis, :reorder_ms, 40
+# If the audio runs out mid-playback the end of the last chunk is played
+# backwards, fading out, to cover the gap for up to this long. Playback picks
+# up where it should be if audio turns up in time, otherwise it stops & waits
+# to start again. Gaps of up to this long in the incoming audio are filled
+# with silence rather than restarting. 0 stops playback straight away.
+config :janis, :max_gap_ms, 200
+# If true playback starts on the frame the audio's due, skipping whatever's
+# already late or padding with silence up to it. If false it waits for the
+# first callback past the audio's time & leaves the sync loop to pull in the
+# difference.
+config :janis, :fast_start, true
+# While the playback speed correction is within 1 ± this ratio the audio is
+# copied straight to the output, bypassing the resampler, & drift is corrected
+# by dropping or repeating single frames. 0.0 disables this.
+config :janis, :passthrough_deadband, 0.0
+# The number of frames handed to the resampler at a time (1 - 1024)
+config :janis, :resampler_chunk_frames, 256
+# The resampler's converter: :linear, :cubic, :fastest, :medium or :best.
+# :fastest, :medium & :best are libsamplerate's sinc converters.
+config :janis, :resampler_quality, :medium
+# If true the driver drops to a cheaper converter while Pa_GetStreamCpuLoad
+# stays above cpu_load_high & goes back up when it drops below cpu_load_low
+config :janis, :resampler_adaptive, true
+config :janis, :cpu_load_high, 0.8
+config :janis, :cpu_load_low,  0.4
+# If true the DAC's drift against our clock is measured & corrected for
+# directly, leaving the sync loop's PID to correct whatever's left
+config :janis, :pid_feed_forward, true
+# If true the PID's gains for small offsets are worked out from the callback
+# period & timing noise over the first seconds of playback instead of using
+# the built in ones
+config :janis, :pid_autotune, false
+# The audio thread's cpu: :last, :none (don't pin it) or a core number. Pick
+# one that isn't handling the sound card's or network's IRQs.
+config :janis, :audio_cpu, :last
+# The audio thread's scheduling policy: :fifo, :rr, :deadline or :other.
+# sched_priority applies to :fifo & :rr, 0 uses the highest. :deadline
+# gets sched_runtime_us of cpu in every sched_period_us & can't be pinned
+# to a cpu.
+config :janis, :sched_policy, :fifo
+config :janis, :sched_priority, 0
+config :janis, :sched_runtime_us, 1000
+config :janis, :sched_period_us, 5000
+# If true, every other thread in the VM, including the schedulers, is moved
+# off the audio thread's cpu once it's been pinned
+config :janis, :isolate_audio_cpu, false
+
 config :janis, Janis.Mdns, false
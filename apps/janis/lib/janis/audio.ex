@@ -8,11 +8,45 @@ defmodule Janis.Audio do
     @implementation.start_link(@name)
   end
 
-  @doc "Sends a timestamped audio packet to the audio system"
+  @doc """
+  Sends an audio packet, timestamped with the broadcaster's clock, to the
+  audio system
+  """
   def play({_timestamp, _data} = packet) do
     GenServer.cast(@name, {:play, packet})
   end
 
+  @doc """
+  Sends `listener` the driver's buffer events:
+
+  - `{:audio_buffer, :high_watermark, fill_ms}` once the driver's buffer fills
+    past the high watermark
+  - `{:audio_buffer, :low_watermark, fill_ms}` once it's drained back down to
+    the low watermark
+  - `{:audio_buffer, :overflow, chunks}` when packets sent with `play/1`
+    didn't fit & the given number of 10ms chunks were dropped
+  """
+  def add_buffer_listener(listener) do
+    GenServer.cast(@name, {:add_buffer_listener, listener})
+  end
+
+  def remove_buffer_listener(listener) do
+    GenServer.cast(@name, {:remove_buffer_listener, listener})
+  end
+
+  @doc """
+  Returns `{:ok, sink}`, something the audio system can be sent packets
+  through directly with `play/2` rather than via its process.
+  """
+  def sink do
+    GenServer.call(@name, :port)
+  end
+
+  @doc "Sends a timestamped audio packet to the sink returned by `sink/0`"
+  def play(sink, {_timestamp, _data} = packet) do
+    @implementation.send_packet(sink, packet)
+  end
+
   def volume do
     GenServer.call(@name, :get_volume)
   end
@@ -21,10 +55,87 @@ defmodule Janis.Audio do
     GenServer.cast(@name, {:set_volume, volume})
   end
 
+  @doc """
+  Returns `{:ok, requested, current}`, the resampler quality asked for &
+  the one actually in use.
+  """
+  def resampler_quality do
+    GenServer.call(@name, :get_resampler_quality)
+  end
+
+  @doc """
+  Sets the resampler quality: `:linear`, `:cubic`, `:fastest`, `:medium` or
+  `:best`.
+  """
+  def resampler_quality(quality) do
+    GenServer.call(@name, {:set_resampler_quality, quality})
+  end
+
+  @doc """
+  Returns `{:ok, stats}` where `stats` is a map of the driver's playback
+  metrics: underrun & late packet counts, the timestamp offset & its
+  percentiles, the resample ratio & PID terms, cpu load, callback durations
+  & a histogram of the ring buffer fill.
+
+  If `reset` is true the metrics start again from zero after this read.
+  """
+  def stats(reset \\ false) do
+    GenServer.call(@name, {:stats, reset})
+  end
+
+  @doc """
+  Reopens the audio stream with the given driver options, e.g.
+
+      Janis.Audio.configure(buffer_ms: 2000, latency_ms: 100, frames_per_buffer: 512)
+
+  or to move to another output backend:
+
+      Janis.Audio.configure(backend: :alsa, device: "hw:0,0")
+
+  Options that aren't given keep their current values. Anything in the
+  driver's buffer is dropped. Returns `{:ok, config}` where `config` holds
+  the buffer size & the latency that was asked for along with the latency
+  PortAudio actually granted, `{:error, :invalid_options}` or
+  `{:error, message}` if the stream couldn't be reopened, in which case the
+  previous settings are restored.
+  """
+  def configure(options) do
+    GenServer.call(@name, {:configure, options})
+  end
+
   def time do
     GenServer.call(@name, :time)
   end
 
+  @doc """
+  Sets the mapping from our clock to the broadcaster's, which the driver
+  uses to play packets stamped with the broadcaster's time: `delta` is the
+  broadcaster's time less ours in µs as measured at our time `since` & `skew`
+  is how many µs the broadcaster's clock gains per µs of ours, capped at
+  ±500ppm. The driver also plays at the speed the skew implies from the start
+  rather than waiting for its sync loop to work it out.
+
+  The new mapping applies to everything in the driver's buffer from its next
+  callback.
+  """
+  def time_delta(delta, since, skew) do
+    GenServer.call(@name, {:time_delta, delta, since, skew})
+  end
+
+  @doc """
+  Makes a time sync exchange with the broadcaster at `ip` & `port`, using
+  `count` as the request's sequence number.
+
+  Returns `{:ok, {originate, receipt, reply, finish}}` where `originate` &
+  `finish` are when the request left & the reply arrived, timestamped by the
+  kernel where it can, & `receipt` & `reply` are the broadcaster's times.
+  Returns `{:error, :timeout}` if there's no reply within a second &
+  `{:error, :address_family}` for anything but an IPv4 address.
+  """
+  def sntp(ip, port, count) do
+    GenServer.call(@name, {:sntp, ip, port, count}, 2000)
+  end
+
   @doc "Stops the audio immediately & flushes the buffers"
   def stop do
     GenServer.cast(@name, :stop)
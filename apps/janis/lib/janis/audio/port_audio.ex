@@ -4,7 +4,6 @@ defmodule Janis.Audio.PortAudio do
   use     GenServer
 
   @shared_lib  "janis"
-  @packet_size 3528
 
   @sample_freq        Application.get_env(:janis, :sample_freq, 44100)
   @sample_bits        Application.get_env(:janis, :sample_bits, 16)
@@ -16,6 +15,39 @@ defmodule Janis.Audio.PortAudio do
   @frame_bytes        (@sample_bytes * @sample_channels)
   @frame_duration_us  1_000_000 * (1.0 / @sample_freq)
 
+  # passed to the driver as `key=value` pairs, see c_src/driver_options.h
+  @driver_options [
+    sample_rate:            @sample_freq,
+    sample_bits:            @sample_bits,
+    channels:               @sample_channels,
+    backend:                Application.get_env(:janis, :output_backend, :portaudio),
+    device:                 Application.get_env(:janis, :output_device, ""),
+    output_format:          Application.get_env(:janis, :output_format, :float32),
+    buffer_ms:              Application.get_env(:janis, :buffer_ms, 640),
+    frames_per_buffer:      Application.get_env(:janis, :frames_per_buffer, 0),
+    latency_ms:             Application.get_env(:janis, :latency_ms, 0),
+    passthrough_deadband:   Application.get_env(:janis, :passthrough_deadband, 0.0),
+    resampler_chunk_frames: Application.get_env(:janis, :resampler_chunk_frames, 256),
+    resampler_quality:      Application.get_env(:janis, :resampler_quality, :medium),
+    resampler_adaptive:     Application.get_env(:janis, :resampler_adaptive, true),
+    cpu_load_high:          Application.get_env(:janis, :cpu_load_high, 0.8),
+    cpu_load_low:           Application.get_env(:janis, :cpu_load_low, 0.4),
+    pid_feed_forward:       Application.get_env(:janis, :pid_feed_forward, true),
+    pid_autotune:           Application.get_env(:janis, :pid_autotune, false),
+    audio_cpu:              Application.get_env(:janis, :audio_cpu, :last),
+    sched_policy:           Application.get_env(:janis, :sched_policy, :fifo),
+    sched_priority:         Application.get_env(:janis, :sched_priority, 0),
+    sched_runtime_us:       Application.get_env(:janis, :sched_runtime_us, 1000),
+    sched_period_us:        Application.get_env(:janis, :sched_period_us, 5000),
+    isolate_audio_cpu:      Application.get_env(:janis, :isolate_audio_cpu, false),
+    overflow:               Application.get_env(:janis, :overflow, :reject),
+    high_watermark:         Application.get_env(:janis, :high_watermark, 0.75),
+    low_watermark:          Application.get_env(:janis, :low_watermark, 0.25),
+    reorder_ms:             Application.get_env(:janis, :reorder_ms, 40),
+    max_gap_ms:             Application.get_env(:janis, :max_gap_ms, 200),
+    fast_start:             Application.get_env(:janis, :fast_start, true),
+  ]
+
 
   def start_link(name) do
     GenServer.start_link(__MODULE__, :ok, name: name)
@@ -25,8 +57,8 @@ defmodule Janis.Audio.PortAudio do
     Janis.set_logger_metadata
     Logger.info "Starting portaudio driver..."
     :ok = load_driver()
-    port = Port.open({:spawn_driver, @shared_lib}, [:stderr_to_stdout, :binary, :stream])
-    {:ok, {port}}
+    port = Port.open({:spawn_driver, driver_command()}, [:stderr_to_stdout, :binary, :stream])
+    {:ok, {port, [], nil}}
   end
 
   @play_command 1
@@ -34,58 +66,167 @@ defmodule Janis.Audio.PortAudio do
   @stop_command 3
   @gvol_command 4
   @svol_command 5
+  @play_packet_command 6
+  @resampler_command 7
+  @stats_command 8
+  @configure_command 9
+  @sntp_command 10
+  @delta_command 11
+
+  # how long to wait for the broadcaster to answer a time sync request
+  @sntp_timeout 1000
 
-  def handle_call(:time, _from, {port} = state) do
+  def handle_call(:time, _from, {port, _listeners, _sntp} = state) do
     # {:ok, c_time} = Port.control(port, @time_command, <<>>) |> decode_port_response
     {:ok, c_time} = :erlang.port_control(port, @time_command, <<>>) |> decode_port_response
     {:reply, {:ok, c_time, monotonic_microseconds()}, state}
   end
 
-  def handle_call(:get_volume, _from, {port} = state) do
+  def handle_call(:port, _from, {port, _listeners, _sntp} = state) do
+    {:reply, {:ok, port}, state}
+  end
+
+  def handle_call(:get_volume, _from, {port, _listeners, _sntp} = state) do
     {:ok, volume} = Port.control(port, @gvol_command, <<>>) |> decode_port_response
     {:reply, {:ok, volume}, state}
   end
 
+  # returns `{:ok, requested, current}` where `current` may be cheaper than
+  # `requested` if the driver has stepped down because of the cpu load
+  def handle_call(:get_resampler_quality, _from, {port, _listeners, _sntp} = state) do
+    reply = :erlang.port_control(port, @resampler_command, <<>>) |> decode_port_response
+    {:reply, reply, state}
+  end
+
+  def handle_call({:set_resampler_quality, quality}, _from, {port, _listeners, _sntp} = state) do
+    Logger.info "Set resampler quality #{quality}"
+    reply = :erlang.port_control(port, @resampler_command, Atom.to_string(quality)) |> decode_port_response
+    {:reply, reply, state}
+  end
+
+  def handle_call({:stats, reset}, _from, {port, _listeners, _sntp} = state) do
+    flag = if reset, do: 1, else: 0
+    reply = :erlang.port_control(port, @stats_command, <<flag>>) |> decode_port_response
+    {:reply, reply, state}
+  end
+
+  # reopens the stream with the given driver options, replying with
+  # `{:ok, config}` where `config` includes the latency PortAudio granted
+  def handle_call({:configure, options}, _from, {port, _listeners, _sntp} = state) do
+    Logger.info "Configure #{inspect options}"
+    reply = :erlang.port_control(port, @configure_command, driver_options(options)) |> decode_port_response
+    {:reply, reply, state}
+  end
+
+  # The driver sends the time sync request & has the kernel timestamp it &
+  # the reply, which comes back as a message that we pass on. Only one
+  # exchange is in flight at a time.
+  def handle_call({:sntp, _ip, _udp_port, _count}, _from, {_port, _listeners, {_, _, _}} = state) do
+    {:reply, {:error, :busy}, state}
+  end
+  def handle_call({:sntp, {a, b, c, d}, udp_port, count}, from, {port, listeners, nil} = state) do
+    request = <<a, b, c, d, udp_port::size(16)-big-unsigned-integer, count::size(64)-big-unsigned-integer>>
+    case :erlang.port_control(port, @sntp_command, request) |> decode_port_response do
+      {:ok, ^count} ->
+        timer = Process.send_after(self(), {:sntp_timeout, count}, @sntp_timeout)
+        {:noreply, {port, listeners, {from, count, timer}}}
+      {:error, _reason} = err ->
+        {:reply, err, state}
+    end
+  end
+  def handle_call({:sntp, _ip, _udp_port, _count}, _from, state) do
+    {:reply, {:error, :address_family}, state}
+  end
+
+  # `delta` is the broadcaster's clock less ours in µs, measured at local
+  # time `since`, & `skew` how many µs it gains per µs of ours
+  def handle_call({:time_delta, delta, since, skew}, _from, {port, _listeners, _sntp} = state) do
+    mapping = <<
+      delta::size(64)-native-signed-integer,
+      since::size(64)-native-unsigned-integer,
+      (skew + 0.0)::size(64)-native-float
+    >>
+    reply = :erlang.port_control(port, @delta_command, mapping) |> decode_port_response
+    {:reply, reply, state}
+  end
+
+  def handle_cast({:add_buffer_listener, listener}, {port, listeners, sntp}) do
+    {:noreply, {port, [listener | listeners], sntp}}
+  end
+
+  def handle_cast({:remove_buffer_listener, listener}, {port, listeners, sntp}) do
+    {:noreply, {port, Enum.reject(listeners, &(&1 == listener)), sntp}}
+  end
+
   def handle_cast({:play, packet}, state) do
     state = play_packet(packet, state)
     {:noreply, state}
   end
 
-  def handle_cast({:set_volume, volume}, {port} = state) do
+  def handle_cast({:set_volume, volume}, {port, _listeners, _sntp} = state) do
     Logger.info "Set volume #{volume}"
     # :ok = Port.control(port, @svol_command, <<volume::size(32)-native-float>>) |> decode_port_response
     :ok = :erlang.port_control(port, @svol_command, <<volume::size(32)-native-float>>) |> decode_port_response
     {:noreply, state}
   end
 
-  def handle_cast(:stop, {port} = state) do
+  def handle_cast(:stop, {port, _listeners, _sntp} = state) do
     Logger.info "Stop"
     # :ok = Port.control(port, @stop_command, <<>>) |> decode_port_response
     :ok = :erlang.port_control(port, @stop_command, <<>>) |> decode_port_response
     {:noreply, state}
   end
 
-  defp play_packet(packet, state) do
-    play_packets(split_packet(packet), state)
+  # The driver tells us when its buffer passes the high watermark & when it's
+  # drained back down to the low watermark, with the fill in ms, & when it had
+  # to reject audio, with the number of 10ms chunks it dropped.
+  def handle_info({port, {:audio_buffer, _event, _value} = message}, {port, listeners, _sntp} = state) do
+    Enum.each(listeners, &send(&1, message))
+    {:noreply, state}
+  end
+
+  # `{originate, receipt, reply, finish}` in µs, see c_src/sntp.h
+  def handle_info({port, {:sntp, count, timestamps}}, {port, listeners, {from, count, timer}}) do
+    Process.cancel_timer(timer)
+    GenServer.reply(from, {:ok, timestamps})
+    {:noreply, {port, listeners, nil}}
+  end
+  def handle_info({port, {:sntp, _count, _timestamps}}, {port, _listeners, _sntp} = state) do
+    {:noreply, state}
+  end
+
+  def handle_info({:sntp_timeout, count}, {port, listeners, {from, count, _timer}}) do
+    GenServer.reply(from, {:error, :timeout})
+    {:noreply, {port, listeners, nil}}
   end
+  def handle_info({:sntp_timeout, _count}, state) do
+    {:noreply, state}
+  end
+
+  # Sending the packet as an iolist goes through the driver's outputv callback
+  # which gets a reference to the audio binary received by the data socket
+  # rather than a copy & converts it straight into its ring buffer. The driver
+  # splits the packet into its internal buffer sizes itself.
+  #
+  # If we need a reply, e.g. the current size of the driver's buffer, then
+  # `@play_packet_command` does the same job through `:erlang.port_control/3`.
+  defp play_packet(packet, {port, _listeners, _sntp} = state) do
+    :ok = send_packet(port, packet)
 
-  defp play_packets([], state) do
     # This is a good time to clean up -- we've just played some packets
     # so we have > 20 ms before this has to happen again
     :erlang.garbage_collect(self())
     state
   end
 
-  defp play_packets([packet | packets], {port} = state) do
-    # {:ok, _buffer_size} = Port.control(port, @play_command, audio_packet(packet)) |> decode_port_response
-    {:ok, _buffer_size} = :erlang.port_control(port, @play_command, audio_packet(packet)) |> decode_port_response
-
-    # TODO: decide if we're worried about the audio buffer here.
-    # case buffer_size do
-    #   1 -> Logger.warn "Audio driver has low buffer #{buffer_size}"
-    #   _ ->
-    # end
-    play_packets(packets, state)
+  @doc """
+  Sends a packet straight to the driver's port. Any process can do this, not
+  just the port's owner, which is how `Janis.Player.Buffer` skips this
+  process when the driver is scheduling playback.
+  """
+  def send_packet(port, {timestamp, data}) do
+    true = Port.command(port, [<< timestamp::size(64)-little-unsigned-integer >>, data])
+    :ok
   end
 
   defp decode_port_response(iodata) do
@@ -93,33 +234,44 @@ defmodule Janis.Audio.PortAudio do
   end
 
   @doc """
-  Takes a single >= 3528 byte timestamped packet & splits it into 1+ 3528 sized packets
-  with offset timestamps
+  Returns the timestamp of the audio `bytes` after the given `timestamp`.
+
+  The driver uses the same calculation (`next_packet_timestamp` in janis.c)
+  when splitting the packets it receives.
   """
-  def split_packet({timestamp, data} = _packet) do
-    split_packet_data(timestamp, data, [])
+  def calculate_timestamp(timestamp, bytes) do
+    # number of bytes should in theory always be a whole number of frames
+    frames = round Float.ceil(bytes / @frame_bytes)
+    # don't want fractions of a microsecond...
+    round(timestamp + (frames * @frame_duration_us))
   end
 
-  defp split_packet_data(_timestamp, <<>>, packets) do
-    Enum.reverse packets
+  @doc """
+  The command used to open the driver port, which passes on the driver's
+  configuration.
+  """
+  def driver_command(options \\ @driver_options) do
+    Enum.join([@shared_lib | format_options(options)], " ")
   end
 
-  defp split_packet_data(timestamp, data, packets) when byte_size(data) < @packet_size do
-    padding = :binary.copy(<<0>>, @packet_size - byte_size(data))
-    padded_data = << data::binary, padding::binary >>
-    [{timestamp, padded_data} | packets ] |> Enum.reverse
+  @doc """
+  The `key=value` pairs sent with `@configure_command`, which change the
+  driver's configuration without reopening the port.
+  """
+  def driver_options(options) do
+    Enum.join(format_options(options), " ")
   end
 
-  defp split_packet_data(timestamp, << packet_data::binary-size(@packet_size), rest::binary >> = data, packets) when byte_size(data) >= @packet_size do
-    next_timestamp = calculate_timestamp(timestamp, byte_size(packet_data))
-    split_packet_data(next_timestamp, rest, [{timestamp, packet_data} | packets ])
+  defp format_options(options) do
+    Enum.map(options, fn({key, value}) -> "#{key}=#{format_option(value)}" end)
   end
 
-  def calculate_timestamp(timestamp, bytes) do
-    # number of bytes should in theory always be a whole number of frames
-    frames = round Float.ceil(bytes / @frame_bytes)
-    # don't want fractions of a microsecond...
-    round(timestamp + (frames * @frame_duration_us))
+  # avoid exponents, e.g. "2.0e-4"
+  defp format_option(value) when is_float(value) do
+    :erlang.float_to_binary(value, [:compact, decimals: 10])
+  end
+  defp format_option(value) do
+    to_string(value)
   end
 
   defp load_driver do
@@ -135,10 +287,4 @@ defmodule Janis.Audio.PortAudio do
   defp priv_dir do
     :code.priv_dir(:janis)
   end
-
-  defp audio_packet({timestamp, data}) do
-    len = byte_size(data)
-    # Logger.debug "Packet time: #{time}; len: #{len} data: #{inspect data}"
-    << timestamp::size(64)-little-unsigned-integer, len::size(16)-little-unsigned-integer, data::binary >>
-  end
 end
@@ -4,6 +4,10 @@ defmodule Janis.Broadcaster.Monitor do
 
   - Calculate latency
   - Calculate time deltas (through the SNTP client)
+  - Estimate how fast the delta is changing, i.e. the skew between the
+    broadcaster's clock & ours
+  - Keep the audio driver's mapping from our clock to the broadcaster's up
+    to date
 
   Once we have calculated an initial latency & time delta this module
   also starts a `Janis.Player` instance.
@@ -14,7 +18,7 @@ defmodule Janis.Broadcaster.Monitor do
   require Logger
 
   alias   Janis.Broadcaster.Monitor.Collector
-  alias   Janis.Math.MovingAverage
+  alias   Janis.Math.DriftEstimator
 
   defmodule S do
     defstruct [
@@ -28,7 +32,8 @@ defmodule Janis.Broadcaster.Monitor do
       collector: nil,
       delta_listeners: [],
       next_measurement_time: nil,
-      delta_average: Janis.Math.DoubleExponentialMovingAverage.new(0.1, 0.02)
+      drift: DriftEstimator.new(),
+      skew: 0.0,
     ]
   end
 
@@ -114,10 +119,11 @@ defmodule Janis.Broadcaster.Monitor do
 
   def append_measurement({new_latency, new_delta} = _measurement, %S{measurement_count: measurement_count, delta: delta} = state) do
     state = append_latency_measurement(new_latency, state)
-    state = append_delta_measurement(new_delta, state)
+    state = append_delta_measurement(new_delta, new_latency, state)
 
     state = %S{ state | measurement_count: measurement_count + 1 }
     state = collect_measurements(state)
+    notify_driver(state)
     notify_delta_change(delta, state)
     # This is a good time to clean up -- we've just emitted some packets
     # so we have > 20 ms before this has to happen again
@@ -125,9 +131,12 @@ defmodule Janis.Broadcaster.Monitor do
     state
   end
 
-  defp notify_delta_change(old_delta, %S{delta: new_delta, next_measurement_time: t, delta_listeners: listeners }) do
+  # The listeners smear the change in the delta out until the next
+  # measurement so we give them the delta we expect by then
+  defp notify_delta_change(old_delta, %S{delta: new_delta, drift: drift, next_measurement_time: t, delta_listeners: listeners }) do
     if old_delta != new_delta do
-      notify_delta_change(new_delta, t, listeners)
+      {:ok, expected_delta, _skew} = DriftEstimator.estimate(drift, t * 1000)
+      notify_delta_change(round(expected_delta), t, listeners)
     end
   end
 
@@ -147,12 +156,22 @@ defmodule Janis.Broadcaster.Monitor do
     %S{ state | latency: max_latency }
   end
 
-  defp append_delta_measurement(measured_delta, %S{ delta_average: avg } = state) do
-    old_delta = MovingAverage.average(avg) |> round
-    avg       = MovingAverage.update(avg, measured_delta)
-    new_delta = MovingAverage.average(avg) |> round
-    Logger.debug "Time Δ: #{String.rjust(to_string(measured_delta), 5)} / #{String.ljust(to_string(new_delta - old_delta), 5)} | #{String.rjust(to_string(new_delta), 5)} ~ #{ Float.round(avg.b + 0.0, 3) }"
-    %S{ state | delta: new_delta, delta_average: avg }
+  defp append_delta_measurement(measured_delta, latency, %S{ delta: old_delta, drift: drift } = state) do
+    now   = monotonic_microseconds()
+    drift = DriftEstimator.update(drift, now, measured_delta, latency)
+    {:ok, delta, skew} = DriftEstimator.estimate(drift, now)
+    new_delta = round(delta)
+    Logger.debug "Time Δ: #{String.rjust(to_string(measured_delta), 5)} / #{String.ljust(to_string(new_delta - (old_delta || new_delta)), 5)} | #{String.rjust(to_string(new_delta), 5)} ~ #{ Float.round(skew * 1.0e6, 3) }ppm"
+    %S{ state | delta: new_delta, drift: drift, skew: skew }
+  end
+
+  # The driver converts the broadcaster's timestamps itself so a new delta
+  # applies to the audio it already has. This is a call so that the first
+  # delta is in place before the player starts sending it audio.
+  defp notify_driver(%S{drift: drift}) do
+    since = monotonic_microseconds()
+    {:ok, delta, skew} = DriftEstimator.estimate(drift, since)
+    :ok = Janis.Audio.time_delta(round(delta), since, skew)
   end
 
   def terminate(reason, _state) do
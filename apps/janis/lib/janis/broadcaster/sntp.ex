@@ -1,6 +1,7 @@
 defmodule Janis.Broadcaster.SNTP do
   @moduledoc ~S"""
-  An SNTP client.
+  An SNTP client. The exchange itself is made by the audio driver, see
+  `Janis.Audio.sntp/3`.
   """
 
   use     GenServer
@@ -49,8 +50,18 @@ defmodule Janis.Broadcaster.SNTP do
     {:reply, response, state}
   end
 
+  # The audio driver makes the exchange on a socket it keeps open, with the
+  # kernel's timestamps, so the VM's scheduling doesn't count as latency.
+  # It only does IPv4 so anything else falls back to doing it here.
   defp ntp_measure(%{broadcaster: broadcaster, sync_count: count} = state) do
+    response = case Janis.Audio.sntp(broadcaster.ip, broadcaster.port, count) do
+      {:error, :address_family} -> udp_measure(broadcaster, count)
+      response                  -> response
+    end
+    {response, %{state | sync_count: count + 1}}
+  end
 
+  defp udp_measure(broadcaster, count) do
     {:ok, socket} = :gen_udp.open(0, [mode: :binary, ip: {0, 0, 0, 0}, active: false])
 
     packet = <<
@@ -63,7 +74,7 @@ defmodule Janis.Broadcaster.SNTP do
       :ok               -> wait_response(socket)
     end
     :gen_udp.close(socket)
-    {response, %{state | sync_count: count + 1}}
+    response
   end
 
   defp wait_response(socket) do
@@ -91,4 +91,65 @@ defmodule Janis.Math do
     def update(avg, value), do: DoubleExponentialMovingAverage.update(avg, value)
     def average(avg), do: DoubleExponentialMovingAverage.average(avg)
   end
+
+  # Estimates the offset between our clock & another one, & how fast it's
+  # changing, from a stream of `(time, offset)` samples by a least squares
+  # fit over a sliding window.
+  #
+  # Samples with a round trip latency well above the best in the window were
+  # probably held up more in one direction than the other so they're left
+  # out of the fit.
+  defmodule DriftEstimator do
+    defstruct window: 64, min_samples: 8, samples: []
+
+    alias __MODULE__, as: E
+
+    # samples are used if their latency is within this multiple of the best,
+    # or this many µs of it
+    @latency_tolerance       2.0
+    @latency_tolerance_floor 100
+
+    def new(window \\ 64, min_samples \\ 8) do
+      %E{window: window, min_samples: min_samples}
+    end
+
+    # `time`, `offset` & `latency` are in µs, `time` on our clock
+    def update(%E{window: window, samples: samples} = e, time, offset, latency) do
+      %E{ e | samples: Enum.take([{time, offset, latency} | samples], window) }
+    end
+
+    # Returns `{:ok, offset, skew}` with the offset predicted at `time` & the
+    # skew in µs gained by the other clock per µs of ours. Until there are
+    # enough samples for a fit it's the latest offset & no skew.
+    def estimate(%E{samples: []}, _time) do
+      :error
+    end
+    def estimate(%E{samples: [{_t, latest, _l} | _], min_samples: min_samples} = e, time) do
+      samples = usable(e)
+      if length(samples) >= min_samples do
+        {t0, offset, skew} = fit(samples)
+        {:ok, offset + skew * (time - t0), skew}
+      else
+        {:ok, latest, 0.0}
+      end
+    end
+
+    defp usable(%E{samples: samples}) do
+      {_t, _o, best} = Enum.min_by(samples, fn({_t, _o, latency}) -> latency end)
+      limit = max(best * @latency_tolerance, best + @latency_tolerance_floor)
+      Enum.filter(samples, fn({_t, _o, latency}) -> latency <= limit end)
+    end
+
+    # fits around the mean time to keep the sums small
+    defp fit(samples) do
+      n  = length(samples)
+      t0 = Enum.reduce(samples, 0, fn({t, _o, _l}, acc) -> acc + t end) / n
+      o0 = Enum.reduce(samples, 0, fn({_t, o, _l}, acc) -> acc + o end) / n
+      {stt, sto} = Enum.reduce(samples, {0.0, 0.0}, fn({t, o, _l}, {stt, sto}) ->
+        {stt + (t - t0) * (t - t0), sto + (t - t0) * (o - o0)}
+      end)
+      skew = if stt > 0.0, do: sto / stt, else: 0.0
+      {t0, o0, skew}
+    end
+  end
 end
@@ -1,6 +1,15 @@
 defmodule Janis.Player.Buffer do
   @moduledoc """
   Receives data from the buffer and passes it onto the playback process on demand
+
+  The packets keep the broadcaster's timestamps, which the driver converts
+  to local time itself (see `Janis.Audio.time_delta/3`). Here they're only
+  translated to work out when to release them.
+
+  With `config :janis, :packet_scheduling, :driver` packets are instead
+  sent straight to the driver as they arrive. The driver holds on to them &
+  plays each one when its time comes, so there's no queue, timer or
+  per-emit garbage collection here.
   """
 
   use     GenServer
@@ -19,6 +28,13 @@ defmodule Janis.Player.Buffer do
       time_delta:      nil,
       last_emit_check: nil,
       interval_timer:  nil,
+      # true between the driver's high & low watermark events, while its
+      # buffer has plenty of audio to be getting on with
+      driver_full:     false,
+      # :player, we queue the packets & release them just ahead of time,
+      # or :driver, they go straight to `sink`
+      scheduling:      :player,
+      sink:            nil,
     ]
   end
 
@@ -43,7 +59,17 @@ defmodule Janis.Player.Buffer do
     # TODO: receiver a monitor instance to avoid having to register the monitor
     # process.
     Janis.Broadcaster.Monitor.add_time_delta_listener(self())
-    {:ok, %S{broadcaster: broadcaster}}
+    state = %S{broadcaster: broadcaster, scheduling: Application.get_env(:janis, :packet_scheduling, :player)}
+    {:ok, init_scheduling(state)}
+  end
+
+  defp init_scheduling(%S{scheduling: :driver} = state) do
+    {:ok, sink} = Janis.Audio.sink()
+    %S{state | sink: sink}
+  end
+  defp init_scheduling(state) do
+    Janis.Audio.add_buffer_listener(self())
+    state
   end
 
   def handle_cast({:put, packet}, state) do
@@ -75,7 +101,7 @@ defmodule Janis.Player.Buffer do
     end
     Janis.Audio.stop()
     Logger.info "Buffer stopped..."
-    {:noreply, %S{state | status: :stopped, queue: :queue.new}}
+    {:noreply, %S{state | status: :stopped, queue: :queue.new, driver_full: false}}
   end
 
   def handle_info(:check_emit, state) do
@@ -83,6 +109,22 @@ defmodule Janis.Player.Buffer do
     {:noreply, state}
   end
 
+  def handle_info({:audio_buffer, :high_watermark, fill_ms}, state) do
+    Logger.debug "Driver buffer high #{fill_ms} ms"
+    {:noreply, %S{state | driver_full: true}}
+  end
+
+  def handle_info({:audio_buffer, :low_watermark, fill_ms}, state) do
+    Logger.debug "Driver buffer low #{fill_ms} ms"
+    state = maybe_emit_packets(%S{state | driver_full: false})
+    {:noreply, state}
+  end
+
+  def handle_info({:audio_buffer, :overflow, chunks}, state) do
+    Logger.warn "Driver buffer overflow, #{chunks * 10} ms dropped"
+    {:noreply, state}
+  end
+
   def next_packet({:value, packet}) do
     {:ok, packet}
   end
@@ -92,6 +134,10 @@ defmodule Janis.Player.Buffer do
     {:error, :empty}
   end
 
+  def put_packet(packet, %S{scheduling: :driver, sink: sink} = state) do
+    :ok = Janis.Audio.play(sink, packet)
+    %S{ state | status: :playing }
+  end
   def put_packet(packet, %S{status: :stopped} = state) do
     {:ok, tref} = :timer.send_interval(check_emit_interval(state), :check_emit)
     # Because our check interval may be higher than the gap between now & the
@@ -103,14 +149,14 @@ defmodule Janis.Player.Buffer do
   end
 
   def put_packet!(packet, %S{status: :playing, queue: queue, count: count} = state) do
-    {translated_packet, state} = translate_packet(packet, state)
-    {timestamp, _} = translated_packet
+    {timestamp, state} = translate_timestamp(packet, state)
     case timestamp - monotonic_microseconds() do
       x when x <= 0 ->
         Logger.warn "Late packet #{x} µs"
       _ -> nil
     end
-    queue = cons(translated_packet, queue, count)
+    # queued by local time, played with the broadcaster's
+    queue = cons({timestamp, packet}, queue, count)
     %S{ state | queue: queue, count: count + 1 }
   end
 
@@ -123,16 +169,20 @@ defmodule Janis.Player.Buffer do
     monitor_queue_length(queue, count)
   end
 
-  defp translate_packet({timestamp, data}, %S{time_delta: time_delta} = state) do
+  defp translate_timestamp({timestamp, _data}, %S{time_delta: time_delta} = state) do
     { delta, time_delta } = Delta.current(time_delta)
-    translated_timestamp = timestamp - delta
-    { {translated_timestamp, data}, %S{ state | time_delta: time_delta } }
+    { timestamp - delta, %S{ state | time_delta: time_delta } }
   end
 
   def maybe_emit_packets(%S{queue: queue} = state) do
     maybe_emit_packets(queue, state)
   end
 
+  # the driver has enough audio queued so keep hold of ours until it tells us
+  # it's drained down to its low watermark
+  def maybe_emit_packets(_queue, %S{driver_full: true} = state) do
+    %S{ state | last_emit_check: monotonic_microseconds() }
+  end
   def maybe_emit_packets(queue, %S{broadcaster: broadcaster, last_emit_check: last_check} = state) do
     interval_ms = Janis.Broadcaster.stream_interval_ms(broadcaster)
 
@@ -182,7 +232,7 @@ defmodule Janis.Player.Buffer do
     emit_packets(state, packets)
   end
 
-  def emit_packet(state, packet) do
+  def emit_packet(state, {_local_timestamp, packet}) do
     Janis.Audio.play(packet)
     state
   end
@@ -203,6 +253,7 @@ defmodule Janis.Player.Buffer do
 
   def terminate(_reason, %S{interval_timer: tref} = _state) do
     Logger.info "Stopping #{__MODULE__}"
+    Janis.Audio.remove_buffer_listener(self())
     remove_handle(tref)
     :ok
   end
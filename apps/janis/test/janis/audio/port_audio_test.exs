@@ -0,0 +1,26 @@
+defmodule Janis.Audio.PortAudioTest do
+  use ExUnit.Case, async: true
+
+  alias Janis.Audio.PortAudio
+
+  test "driver command includes the driver options" do
+    command = PortAudio.driver_command([output_format: :int16, passthrough_deadband: 0.0002])
+    assert command == "janis output_format=int16 passthrough_deadband=0.0002"
+
+    command = PortAudio.driver_command([resampler_quality: :best, resampler_adaptive: false])
+    assert command == "janis resampler_quality=best resampler_adaptive=false"
+  end
+
+  test "driver command with no options is just the driver name" do
+    assert PortAudio.driver_command([]) == "janis"
+  end
+
+  test "configure options are the driver options without the driver name" do
+    options = PortAudio.driver_options([buffer_ms: 2000, latency_ms: 40.5, frames_per_buffer: 512])
+    assert options == "buffer_ms=2000 latency_ms=40.5 frames_per_buffer=512"
+  end
+
+  test "timestamps advance by the duration of the given bytes" do
+    assert PortAudio.calculate_timestamp(1_000_000, 3528) == 1_020_000
+  end
+end
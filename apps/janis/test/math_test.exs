@@ -60,4 +60,44 @@ defmodule Janis.MathTest do
       assert_in_delta MA.average(a), 8.5, 0.00001
     end
   end
+  defmodule DriftEstimator do
+    use ExUnit.Case, async: true
+
+    alias Janis.Math.DriftEstimator, as: E
+
+    # an offset of 500µs gaining 20ppm, sampled every second
+    defp samples(e, count, latency \\ fn(_i) -> 200 end) do
+      Enum.reduce(0..(count - 1), e, fn(i, e) ->
+        t = i * 1_000_000
+        E.update(e, t, 500 + t * 20.0e-6, latency.(i))
+      end)
+    end
+
+    test "it uses the latest offset until it has enough samples" do
+      e = samples(E.new(64, 8), 3)
+      assert {:ok, offset, 0.0} = E.estimate(e, 2_000_000)
+      assert_in_delta offset, 540, 0.001
+    end
+
+    test "it fits the offset & skew" do
+      e = samples(E.new(64, 8), 20)
+      {:ok, offset, skew} = E.estimate(e, 30_000_000)
+      assert_in_delta skew, 20.0e-6, 1.0e-9
+      assert_in_delta offset, 1100, 0.001
+    end
+
+    test "it leaves out samples with high latency" do
+      # every 4th sample was held up on the way back
+      e = Enum.reduce(0..19, E.new(64, 8), fn(i, e) ->
+        t = i * 1_000_000
+        if rem(i, 4) == 0 do
+          E.update(e, t, 500 + t * 20.0e-6 - 2000, 4200)
+        else
+          E.update(e, t, 500 + t * 20.0e-6, 200)
+        end
+      end)
+      {:ok, _offset, skew} = E.estimate(e, 30_000_000)
+      assert_in_delta skew, 20.0e-6, 1.0e-9
+    end
+  end
 end